@@ -0,0 +1,531 @@
+#ifndef FMINDEX_INCLUDED
+#define FMINDEX_INCLUDED
+
+#include "PackedSequence.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// An FM-index over a set of DNA sequences: the Burrows-Wheeler transform of
+// the reversed, $-separated concatenation of the sequences, with rank
+// support and a sampled suffix array.  Because the text is reversed,
+// backward search consumes a pattern from its first base to its last, so a
+// search that substitutes a base only has to redo the bases after it.
+class FMIndex
+{
+public:
+	FMIndex();
+	  // Builds the index, or leaves it empty and returns false if the
+	  // sequences don't fit in one.
+	bool build(const std::vector<const PackedSequence*>& sequences);
+	  // Whether sequences holding bases bases in all fit in one index.  The
+	  // suffix array is built with 32-bit signed positions, so the text, a
+	  // separator after each sequence and the sentinel included, must have
+	  // fewer than 2^31 symbols.
+	static bool fits(size_t sequences, size_t bases);
+	bool empty() const;
+	  // Adds the memory of the BWT and its rank and sample bookkeeping to
+	  // structure, and of the sampled text positions to samples.
+	void countMemory(MemoryTally& structure, MemoryTally& samples) const;
+
+	  // Calls report(sequence, position) for every occurrence of the
+	  // keyLength bases at key, of any length, found by backward search.
+	  // When exactMatchOnly is false it also reports the places where key's
+	  // first base matches and exactly one other base differs.  A search
+	  // that gets down to a handful of rows reports them without matching
+	  // the rest of the key, so callers must verify what is reported.  rows
+	  // is the caller's to reuse from search to search, so a search only
+	  // allocates when it needs more rows than any search before it.
+	template<typename Report>
+	void findSeeds(const char* key, int keyLength, bool exactMatchOnly,
+		std::vector<std::pair<uint32_t, uint32_t> >& rows, Report report) const;
+
+	  // The BWT blocks, the samples and where each sequence starts, for an
+	  // index file.
+	template<typename Writer>
+	void save(Writer& out) const;
+	template<typename Reader>
+	bool load(Reader& in);
+private:
+	  // Symbols, in suffix order: the end-of-text sentinel, the sequence
+	  // separator, the four bases and N.
+	enum { END = 0, SEPARATOR = 1, BASE_A = 2, BASE_N = 6, SIGMA = 7 };
+	static const int SA_SAMPLE = 32;      // suffix array values kept for text positions divisible by this
+	static const uint32_t VERIFY_ROWS = 1;   // searches stop extending once this few rows are left
+	static const uint32_t MAX_TEXT_LENGTH = 0x7FFFFFFF;    // what int32_t suffix array positions reach
+
+	  // Rank directory for 64 BWT rows: ACGT in 2 bits, with $, N and the
+	  // sentinel stored as A and flagged in special.  One cache line.
+	struct Block
+	{
+		uint32_t counts[6];               // occurrences of A, C, G, T, $, N before this block
+		uint64_t bases[2];
+		uint64_t special;
+		uint64_t nBits;                   // which specials are N
+		uint64_t pad;
+	};
+
+	Storage<Block> m_blocks;
+	uint32_t m_c[SIGMA + 1];              // rows before the first suffix starting with each symbol
+	uint32_t m_rows;                      // text length including the sentinel
+	uint32_t m_endRow;                    // row whose BWT symbol is the sentinel
+	Storage<uint64_t> m_sampledRows;
+	Storage<uint32_t> m_sampledRank;      // sampled rows before each word of m_sampledRows
+	Storage<uint32_t> m_samples;          // text positions of the sampled rows, in row order
+	Storage<uint32_t> m_starts;           // where each sequence starts in the forward text
+	uint32_t m_textLength;                // forward text length, separators included
+
+	static int symbol(char base);
+	static uint64_t spread(uint32_t bits);
+	int symbolAt(uint32_t row) const;
+	uint32_t rank(int sym, uint32_t row) const;
+	uint32_t lf(uint32_t row) const;
+	uint32_t locate(uint32_t row) const;
+	void toSequence(uint32_t reversedPosition, int length, uint32_t& sequence, uint32_t& position) const;
+
+	template<typename Char>
+	static void suffixArray(const Char* s, int32_t* sa, int32_t n, int32_t k);
+	template<typename Char>
+	static void buckets(const Char* s, std::vector<int32_t>& bkt, int32_t n, int32_t k, bool end);
+	template<typename Char>
+	static void induce(const std::vector<uint8_t>& t, int32_t* sa, const Char* s, std::vector<int32_t>& bkt,
+		int32_t n, int32_t k);
+};
+
+inline FMIndex::FMIndex()
+	:m_rows(0), m_endRow(0), m_textLength(0)
+{
+	std::fill(m_c, m_c + SIGMA + 1, 0);
+}
+
+inline bool FMIndex::empty() const
+{
+	return m_rows == 0;
+}
+
+inline int FMIndex::symbol(char base)
+{
+	if (base == 'N')
+		return BASE_N;
+	int c = PackedSequence::code(base);
+	return c < 0 || base > 'Z' ? -1 : BASE_A + c;
+}
+
+inline uint64_t FMIndex::spread(uint32_t bits)       //bit i moves to bit 2i
+{
+	uint64_t x = bits;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+	x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x << 2)) & 0x3333333333333333ULL;
+	x = (x | (x << 1)) & 0x5555555555555555ULL;
+	return x;
+}
+
+inline bool FMIndex::fits(size_t sequences, size_t bases)
+{
+	return bases <= MAX_TEXT_LENGTH && sequences < MAX_TEXT_LENGTH - bases;
+}
+
+inline bool FMIndex::build(const std::vector<const PackedSequence*>& sequences)
+{
+	size_t length = 0;
+	for (size_t i = 0; i != sequences.size(); i++)
+		length += sequences[i]->length();
+	if (!fits(sequences.size(), length))
+	{
+		*this = FMIndex();
+		return false;
+	}
+	  //reversed text: rev(last) $ ... rev(first) $ sentinel
+	std::vector<uint8_t> text;
+	text.reserve(length + sequences.size() + 1);
+	m_starts.resize(sequences.size());
+	std::string bases;
+	for (size_t i = sequences.size(); i-- != 0; )
+	{
+		sequences[i]->unpack(0, sequences[i]->length(), bases);
+		for (size_t j = bases.size(); j-- != 0; )
+			text.push_back((uint8_t)symbol(bases[j]));
+		text.push_back(SEPARATOR);
+	}
+	m_textLength = (uint32_t)text.size();
+	uint32_t start = 0;
+	for (size_t i = 0; i != sequences.size(); i++)    //the forward text is $ first $ ... $ last
+	{
+		m_starts[i] = start + 1;
+		start += sequences[i]->length() + 1;
+	}
+	text.push_back(END);
+	m_rows = (uint32_t)text.size();
+
+	std::vector<int32_t> sa(m_rows);
+	suffixArray(&text[0], &sa[0], (int32_t)m_rows, SIGMA - 1);
+
+	std::fill(m_c, m_c + SIGMA + 1, 0);
+	for (uint32_t i = 0; i != m_rows; i++)
+		m_c[text[i] + 1]++;
+	for (int c = 0; c != SIGMA; c++)
+		m_c[c + 1] += m_c[c];
+
+	m_blocks.assign(m_rows / 64 + 1, Block());
+	m_sampledRows.assign(m_rows / 64 + 1, 0);
+	m_sampledRank.assign(m_rows / 64 + 1, 0);
+	m_samples.clear();
+	m_samples.reserve(m_rows / SA_SAMPLE + 1);
+	uint32_t counts[6] = { 0, 0, 0, 0, 0, 0 };
+	uint32_t sampled = 0;
+	for (uint32_t row = 0; row != m_rows; row++)
+	{
+		Block& b = m_blocks[row / 64];
+		int bit = row % 64;
+		if (bit == 0)
+		{
+			std::copy(counts, counts + 6, b.counts);
+			m_sampledRank[row / 64] = sampled;
+		}
+		int sym = sa[row] == 0 ? (int)END : text[sa[row] - 1];
+		if (sym >= BASE_A && sym < BASE_N)
+		{
+			b.bases[bit / 32] |= (uint64_t)(sym - BASE_A) << (2 * (bit % 32));
+			counts[sym - BASE_A]++;
+		}
+		else
+		{
+			b.special |= 1ULL << bit;
+			if (sym == BASE_N)
+			{
+				b.nBits |= 1ULL << bit;
+				counts[5]++;
+			}
+			else if (sym == SEPARATOR)
+				counts[4]++;
+			else
+				m_endRow = row;
+		}
+		if (sa[row] % SA_SAMPLE == 0)
+		{
+			m_sampledRows[row / 64] |= 1ULL << bit;
+			m_samples.push_back((uint32_t)sa[row]);
+			sampled++;
+		}
+	}
+	if (m_rows % 64 == 0)       //the block after the last row still needs its counts
+	{
+		std::copy(counts, counts + 6, m_blocks.back().counts);
+		m_sampledRank.back() = sampled;
+	}
+	return true;
+}
+
+inline void FMIndex::countMemory(MemoryTally& structure, MemoryTally& samples) const
+{
+	structure.add(m_blocks);
+	structure.add(m_sampledRows);
+	structure.add(m_sampledRank);
+	structure.add(m_starts);
+	samples.add(m_samples);
+}
+
+template<typename Writer>
+void FMIndex::save(Writer& out) const
+{
+	out.value(m_rows);
+	out.value(m_endRow);
+	out.value(m_textLength);
+	out.array(m_c, SIGMA + 1);
+	out.array(m_blocks.data(), m_blocks.size());
+	out.array(m_sampledRows.data(), m_sampledRows.size());
+	out.array(m_sampledRank.data(), m_sampledRank.size());
+	out.array(m_samples.data(), m_samples.size());
+	out.array(m_starts.data(), m_starts.size());
+}
+
+template<typename Reader>
+bool FMIndex::load(Reader& in)
+{
+	Storage<uint32_t> c;
+	if (!in.value(m_rows) || !in.value(m_endRow) || !in.value(m_textLength) || !in.array(c)
+		|| !in.array(m_blocks) || !in.array(m_sampledRows) || !in.array(m_sampledRank)
+		|| !in.array(m_samples) || !in.array(m_starts))
+		return false;
+	if (c.size() != SIGMA + 1 || m_blocks.size() != m_rows / 64 + 1 || m_sampledRows.size() != m_blocks.size()
+		|| m_sampledRank.size() != m_blocks.size())
+		return false;
+	std::copy(c.begin(), c.end(), m_c);
+	return true;
+}
+
+inline int FMIndex::symbolAt(uint32_t row) const
+{
+	const Block& b = m_blocks[row / 64];
+	int bit = row % 64;
+	if (b.special & (1ULL << bit))
+	{
+		if (b.nBits & (1ULL << bit))
+			return BASE_N;
+		return row == m_endRow ? END : SEPARATOR;
+	}
+	return BASE_A + (int)((b.bases[bit / 32] >> (2 * (bit % 32))) & 3);
+}
+
+// Occurrences of sym in the BWT rows before row.
+inline uint32_t FMIndex::rank(int sym, uint32_t row) const
+{
+	const Block& b = m_blocks[row / 64];
+	int bit = row % 64;
+	uint64_t below = bit == 0 ? 0 : ~0ULL >> (64 - bit);
+	if (sym == BASE_N)
+		return b.counts[5] + PackedSequence::popcount(b.nBits & below);
+	if (sym == SEPARATOR)
+	{
+		uint32_t n = b.counts[4] + PackedSequence::popcount(b.special & ~b.nBits & below);
+		if (m_endRow / 64 == row / 64 && m_endRow < row)
+			n--;                          //the sentinel is flagged like a separator
+		return n;
+	}
+	uint64_t pattern = (uint64_t)(sym - BASE_A) * PackedSequence::LOW_BITS;
+	uint32_t n = b.counts[sym - BASE_A];
+	for (int w = 0; w != 2 && bit > 32 * w; w++)
+	{
+		uint64_t x = b.bases[w] ^ pattern;
+		uint64_t eq = ~(x | (x >> 1)) & PackedSequence::LOW_BITS;
+		eq &= ~spread((uint32_t)(b.special >> (32 * w)));
+		int chars = std::min(32, bit - 32 * w);
+		if (chars < 32)
+			eq &= (1ULL << (2 * chars)) - 1;
+		n += PackedSequence::popcount(eq);
+	}
+	return n;
+}
+
+inline uint32_t FMIndex::lf(uint32_t row) const
+{
+	int sym = symbolAt(row);
+	return m_c[sym] + rank(sym, row);
+}
+
+// Position in the reversed text of the suffix at row.
+inline uint32_t FMIndex::locate(uint32_t row) const
+{
+	uint32_t steps = 0;
+	for (;;)
+	{
+		uint64_t word = m_sampledRows[row / 64];
+		int bit = row % 64;
+		if (word & (1ULL << bit))
+		{
+			uint64_t below = bit == 0 ? 0 : ~0ULL >> (64 - bit);
+			return m_samples[m_sampledRank[row / 64] + PackedSequence::popcount(word & below)] + steps;
+		}
+		row = lf(row);
+		steps++;
+	}
+}
+
+inline void FMIndex::toSequence(uint32_t reversedPosition, int length, uint32_t& sequence, uint32_t& position) const
+{
+	uint32_t forward = m_textLength - reversedPosition - length;
+	sequence = (uint32_t)(std::upper_bound(m_starts.begin(), m_starts.end(), forward) - m_starts.begin()) - 1;
+	position = forward - m_starts[sequence];
+}
+
+template<typename Report>
+void FMIndex::findSeeds(const char* key, int keyLength, bool exactMatchOnly,
+	std::vector<std::pair<uint32_t, uint32_t> >& rows, Report report) const
+{
+	const int k = keyLength;
+	if (empty() || k == 0)
+		return;
+	for (int i = 0; i != k; i++)
+	{
+		if (symbol(key[i]) < 0)
+			return;
+	}
+	  //once a search is down to a few rows it stops and leaves the rest of
+	  //the key to the caller's verification
+	std::vector<std::pair<uint32_t, uint32_t> >& exact = rows;     //exact[d] covers the first d bases
+	exact.clear();
+	exact.push_back(std::make_pair(0u, m_rows));
+	bool narrowed = false;
+	for (int i = 0; i != k; i++)
+	{
+		if (i != 0 && exact.back().second - exact.back().first <= VERIFY_ROWS)
+		{
+			narrowed = true;
+			break;
+		}
+		int sym = symbol(key[i]);
+		uint32_t lo = m_c[sym] + rank(sym, exact.back().first);
+		uint32_t hi = m_c[sym] + rank(sym, exact.back().second);
+		if (lo >= hi)
+			break;
+		exact.push_back(std::make_pair(lo, hi));
+	}
+	auto reportRows = [this, &report](uint32_t lo, uint32_t hi, int depth) {
+		for (uint32_t row = lo; row != hi; row++)
+		{
+			uint32_t sequence, position;
+			toSequence(locate(row), depth, sequence, position);
+			report(sequence, position);
+		}
+	};
+	int depth = (int)exact.size() - 1;
+	if (narrowed || depth == k)
+		reportRows(exact.back().first, exact.back().second, depth);
+	if (!exactMatchOnly)
+	{
+		  //substitute each base after the first, then match the rest exactly;
+		  //rows already reported by a narrowed exact search need no substitutes
+		int lastSubstitute = narrowed || depth == k ? depth - 1 : depth;
+		for (int d = 1; d < k && d <= lastSubstitute; d++)
+		{
+			for (int sym = BASE_A; sym <= BASE_N; sym++)
+			{
+				if (sym == symbol(key[d]))
+					continue;
+				uint32_t lo = m_c[sym] + rank(sym, exact[d].first);
+				uint32_t hi = m_c[sym] + rank(sym, exact[d].second);
+				int i = d + 1;
+				for (; i != k && lo < hi && hi - lo > VERIFY_ROWS; i++)
+				{
+					int next = symbol(key[i]);
+					lo = m_c[next] + rank(next, lo);
+					hi = m_c[next] + rank(next, hi);
+				}
+				if (lo < hi)
+					reportRows(lo, hi, i);
+			}
+		}
+	}
+}
+
+// SA-IS suffix array construction (Nong, Zhang and Chan).  s[n - 1] must be
+// a unique smallest symbol and every symbol must be at most k.
+template<typename Char>
+void FMIndex::suffixArray(const Char* s, int32_t* sa, int32_t n, int32_t k)
+{
+	if (n == 1)
+	{
+		sa[0] = 0;
+		return;
+	}
+	std::vector<uint8_t> t(n);            //1 for S-type suffixes, 0 for L-type
+	t[n - 1] = 1;
+	t[n - 2] = 0;
+	for (int32_t i = n - 3; i >= 0; i--)
+		t[i] = (s[i] < s[i + 1] || (s[i] == s[i + 1] && t[i + 1] == 1)) ? 1 : 0;
+	auto isLMS = [&t](int32_t i) { return i > 0 && t[i] && !t[i - 1]; };
+
+	  //stage 1: sort the LMS substrings
+	std::vector<int32_t> bkt;
+	buckets(s, bkt, n, k, true);
+	std::fill(sa, sa + n, -1);
+	for (int32_t i = 1; i < n; i++)
+	{
+		if (isLMS(i))
+			sa[--bkt[s[i]]] = i;
+	}
+	induce(t, sa, s, bkt, n, k);
+
+	int32_t n1 = 0;
+	for (int32_t i = 0; i < n; i++)
+	{
+		if (isLMS(sa[i]))
+			sa[n1++] = sa[i];
+	}
+	std::fill(sa + n1, sa + n, -1);
+	int32_t name = 0, prev = -1;
+	for (int32_t i = 0; i < n1; i++)
+	{
+		int32_t pos = sa[i];
+		bool diff = false;
+		for (int32_t d = 0; d < n; d++)
+		{
+			if (prev == -1 || s[pos + d] != s[prev + d] || t[pos + d] != t[prev + d])
+			{
+				diff = true;
+				break;
+			}
+			else if (d > 0 && (isLMS(pos + d) || isLMS(prev + d)))
+				break;
+		}
+		if (diff)
+		{
+			name++;
+			prev = pos;
+		}
+		sa[n1 + pos / 2] = name - 1;
+	}
+	for (int32_t i = n - 1, j = n - 1; i >= n1; i--)
+	{
+		if (sa[i] >= 0)
+			sa[j--] = sa[i];
+	}
+
+	  //stage 2: sort the reduced problem, recursing if names repeat
+	int32_t* sa1 = sa;
+	int32_t* s1 = sa + n - n1;
+	if (name < n1)
+		suffixArray(s1, sa1, n1, name - 1);
+	else
+	{
+		for (int32_t i = 0; i < n1; i++)
+			sa1[s1[i]] = i;
+	}
+
+	  //stage 3: induce the full suffix array from the sorted LMS suffixes
+	buckets(s, bkt, n, k, true);
+	for (int32_t i = 1, j = 0; i < n; i++)
+	{
+		if (isLMS(i))
+			s1[j++] = i;
+	}
+	for (int32_t i = 0; i < n1; i++)
+		sa1[i] = s1[sa1[i]];
+	std::fill(sa + n1, sa + n, -1);
+	for (int32_t i = n1 - 1; i >= 0; i--)
+	{
+		int32_t j = sa[i];
+		sa[i] = -1;
+		sa[--bkt[s[j]]] = j;
+	}
+	induce(t, sa, s, bkt, n, k);
+}
+
+template<typename Char>
+void FMIndex::buckets(const Char* s, std::vector<int32_t>& bkt, int32_t n, int32_t k, bool end)
+{
+	bkt.assign(k + 1, 0);
+	for (int32_t i = 0; i < n; i++)
+		bkt[s[i]]++;
+	int32_t sum = 0;
+	for (int32_t i = 0; i <= k; i++)
+	{
+		sum += bkt[i];
+		bkt[i] = end ? sum : sum - bkt[i];
+	}
+}
+
+template<typename Char>
+void FMIndex::induce(const std::vector<uint8_t>& t, int32_t* sa, const Char* s, std::vector<int32_t>& bkt,
+	int32_t n, int32_t k)
+{
+	buckets(s, bkt, n, k, false);            //L-type suffixes, left to right
+	for (int32_t i = 0; i < n; i++)
+	{
+		int32_t j = sa[i] - 1;
+		if (j >= 0 && !t[j])
+			sa[bkt[s[j]]++] = j;
+	}
+	buckets(s, bkt, n, k, true);             //S-type suffixes, right to left
+	for (int32_t i = n - 1; i >= 0; i--)
+	{
+		int32_t j = sa[i] - 1;
+		if (j >= 0 && t[j])
+			sa[--bkt[s[j]]] = j;
+	}
+}
+
+#endif // FMINDEX_INCLUDED
@@ -1,28 +1,57 @@
 #include "provided.h"
+#include "PackedSequence.h"
 #include <string>
 #include <vector>
 #include <iostream>
 #include <istream>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <atomic>
 using namespace std;
 
 class GenomeImpl
 {
 public:
     GenomeImpl(const string& nm, const string& sequence);
+    GenomeImpl(const string& nm, const PackedSequence& sequence);
+    GenomeImpl(const string& nm, PackedSequence&& sequence);
     static bool load(istream& genomeSource, vector<Genome>& genomes);
     int length() const;
     string name() const;
     bool extract(int position, int length, string& fragment) const;
+	const PackedSequence& sequence() const;
+	  // Copies of a Genome share its GenomeImpl, which never changes once it
+	  // is made; the last copy to go deletes it.
+	void addRef() const;
+	bool release() const;                 // true when that was the last reference
 private:
 	string m_name;
-	string m_dna;
+	PackedSequence m_dna;
+	mutable atomic<int> m_refs;
 };
 
 GenomeImpl::GenomeImpl(const string& nm, const string& sequence)
+	:m_name(nm), m_dna(sequence), m_refs(1)
+{}
+
+GenomeImpl::GenomeImpl(const string& nm, const PackedSequence& sequence)
+	:m_name(nm), m_dna(sequence), m_refs(1)
+{}
+
+GenomeImpl::GenomeImpl(const string& nm, PackedSequence&& sequence)
+	:m_name(nm), m_dna(move(sequence)), m_refs(1)
+{}
+
+void GenomeImpl::addRef() const
+{
+	m_refs.fetch_add(1, memory_order_relaxed);
+}
+
+bool GenomeImpl::release() const
 {
-	m_name = nm;
-	m_dna = sequence;
+	return m_refs.fetch_sub(1, memory_order_acq_rel) == 1;
 }
 
 bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes) 
@@ -32,67 +61,101 @@ bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
 		cerr << "Error: Cannot open file" << endl;
 		return false;
 	}
-	char c; string s; string dna; bool justNewlined = false; Genome* g;
-	genomeSource.get(c);
-	if (c != '>')                //check that the file starts with a name line
+	  //read big blocks and handle a line (or the part of it in the block) at a
+	  //time, packing bases straight from the block; the name and bases of the
+	  //genome being read carry over from block to block
+	const size_t BLOCK_SIZE = 1 << 20;
+	const streamoff MAX_RESERVE = 1 << 28;
+	vector<char> block(BLOCK_SIZE);
+	string s; PackedSequence dna; bool justNewlined = false; bool inName = true;
+	streamoff total = -1;                 //bytes of input, if the stream can tell
+	streamoff consumed = 0;               //bytes in blocks before this one
+	streamoff expected = MAX_RESERVE;     //bases the next genome is likely to have: as many as the last one
+	streampos here = genomeSource.tellg();
+	if (here != streampos(-1) && genomeSource.seekg(0, ios::end))
 	{
-		cerr << "Error: file does not start with a name line" << endl;
-		return false;
+		total = genomeSource.tellg() - here;
+		genomeSource.seekg(here);
 	}
-	else 
+	genomeSource.clear();
+
+	genomeSource.read(&block[0], BLOCK_SIZE);
+	size_t n = genomeSource.gcount();
+	if (n == 0 || block[0] != '>')                //check that the file starts with a name line
 	{
-		getline(genomeSource, s);  //read in the name of the first organism in the file
+		cerr << "Error: file does not start with a name line" << endl;
+		return false;
 	}
-	while (genomeSource.get(c))
+	size_t pos = 1;
+	for (;;)
 	{
-		switch (c)
+		const char* p = &block[pos];
+		const char* end = &block[0] + n;
+		while (p != end)
 		{
-		case 'A':
-		case 'C':
-		case 'T':
-		case 'G':
-		case 'N':
-		case 'a':
-		case 'c':
-		case 't':
-		case 'g':
-		case 'n':
-			justNewlined = false;
-			dna += toupper(c);
-			break;
-		case '\n':
-			if (justNewlined)
+			const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+			const char* lineEnd = newline != nullptr ? newline : end;
+			if (inName)                   //the rest of the line is the name
 			{
-				cerr << "Error: file contains empty line" << endl;
-				return false;
+				s.append(p, lineEnd);
+				if (newline == nullptr)
+					break;
+				inName = false;
+				justNewlined = false;
+				p = newline + 1;
+				if (total > 0)            //the bases can't take more than the rest of the input
+					dna.reserve((int)min(total - consumed - (p - &block[0]), expected));
+				continue;
 			}
-			else
-				justNewlined = true;
-			break;
-		case '>':
-			if (dna == "")
+			int length = lineEnd - p;
+			int valid = PackedSequence::validPrefix(p, length);
+			dna.append(p, valid);
+			if (valid != 0)
+				justNewlined = false;
+			if (valid != length)
 			{
-				cerr << "Error: no bases after name line" << endl;
-				return false;
+				if (p[valid] != '>')
+				{
+					cerr << "Error: invalid base character" << endl;
+					return false;
+				}
+				if (dna.length() == 0)
+				{
+					cerr << "Error: no bases after name line" << endl;
+					return false;
+				}
+				if (s == "")
+				{
+					cerr << "Error: no characters after > in name line" << endl;
+					return false;
+				}
+				dna.shrinkToFit();
+				expected = dna.length();
+				genomes.emplace_back(s, move(dna));
+				s = ""; dna = PackedSequence();
+				inName = true;
+				p += valid + 1;
+				continue;
 			}
-			if (s == "")
+			if (newline == nullptr)
+				break;
+			if (justNewlined)
 			{
-				cerr << "Error: no characters after > in name line" << endl;
+				cerr << "Error: file contains empty line" << endl;
 				return false;
 			}
-			g = new Genome(s, dna);
-			genomes.push_back(*g);
-			s = ""; dna = "";
-			getline(genomeSource, s);
-			justNewlined = false;
-			break;
-		default:
-			cerr << "Error: invalid base character" << endl;
-			return false;
+			justNewlined = true;
+			p = newline + 1;
 		}
+		consumed += n;
+		genomeSource.read(&block[0], BLOCK_SIZE);
+		n = genomeSource.gcount();
+		if (n == 0)
+			break;
+		pos = 0;
 	}
 
-	if (dna == "")
+	if (dna.length() == 0)
 	{
 		cerr << "Error: no bases after name line" << endl;
 		return false;
@@ -102,14 +165,14 @@ bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
 		cerr << "Error: no characters after > in name line" << endl;
 		return false;
 	}
-	g = new Genome(s, dna);
-	genomes.push_back(*g);
+	dna.shrinkToFit();
+	genomes.emplace_back(s, move(dna));
 	return true;
 }
 
 int GenomeImpl::length() const
 {
-	return m_dna.size();
+	return m_dna.length();
 }
 
 string GenomeImpl::name() const
@@ -123,10 +186,15 @@ bool GenomeImpl::extract(int position, int length, string& fragment) const
 		return false; 
 	if (position >= this->length() || (position + length) > this->length())
 		return false;
-	fragment = m_dna.substr(position, length);
+	m_dna.unpack(position, length, fragment);
 	return true;
 }
 
+const PackedSequence& GenomeImpl::sequence() const
+{
+	return m_dna;
+}
+
 //******************** Genome functions ************************************
 
 // These functions simply delegate to GenomeImpl's functions.
@@ -137,21 +205,46 @@ Genome::Genome(const string& nm, const string& sequence)
     m_impl = new GenomeImpl(nm, sequence);
 }
 
+Genome::Genome(const string& nm, const PackedSequence& sequence)
+{
+    m_impl = new GenomeImpl(nm, sequence);
+}
+
+Genome::Genome(const string& nm, PackedSequence&& sequence)
+{
+    m_impl = new GenomeImpl(nm, move(sequence));
+}
+
 Genome::~Genome()
 {
-    delete m_impl;
+    if (m_impl != nullptr && m_impl->release())
+        delete m_impl;
 }
 
 Genome::Genome(const Genome& other)
 {
-    m_impl = new GenomeImpl(*other.m_impl);
+    m_impl = other.m_impl;
+    m_impl->addRef();
+}
+
+Genome::Genome(Genome&& other) noexcept
+{
+    m_impl = other.m_impl;
+    other.m_impl = nullptr;
 }
 
 Genome& Genome::operator=(const Genome& rhs)
 {
-    GenomeImpl* newImpl = new GenomeImpl(*rhs.m_impl);
-    delete m_impl;
-    m_impl = newImpl;
+    rhs.m_impl->addRef();                 // before the release, in case rhs is *this
+    if (m_impl != nullptr && m_impl->release())
+        delete m_impl;
+    m_impl = rhs.m_impl;
+    return *this;
+}
+
+Genome& Genome::operator=(Genome&& rhs) noexcept
+{
+    swap(m_impl, rhs.m_impl);
     return *this;
 }
 
@@ -175,5 +268,10 @@ bool Genome::extract(int position, int length, string& fragment) const
     return m_impl->extract(position, length, fragment);
 }
 
+const PackedSequence& Genome::sequence() const
+{
+    return m_impl->sequence();
+}
+
 
 
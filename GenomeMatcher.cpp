@@ -3,188 +3,1535 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
-#include <map>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <limits>
 #include "Trie.h"
+#include "PackedSequence.h"
+#include "FMIndex.h"
+#include "KmerIndex.h"
+#include "Sketch.h"
+#include "QueryCache.h"
+#include "IndexFile.h"
 using namespace std;
 
 bool compareGenomeMatch(const GenomeMatch& lhs, const GenomeMatch& rhs);
 
-class GenomeMatcherImpl
+const int MINIMIZER_MIN = 10;             //bases in a MINIMIZER_INDEX k-mer
+const int MINIMIZER_MAX = 16;
+const size_t QUERY_CACHE_SIZE = 0;        //fragments whose hits are cached, by default: none
+const size_t MERGE_FANOUT = 8;            //segments of a size class merge into one once there are this many
+const double COMPACT_FRACTION = 0.25;     //a segment is rebuilt once more than this share of its bases is removed
+
+// The parts of a library that memoryUsage reports.
+enum MemoryPart { SEQUENCES, NAMES, INDEX_NODES, POSTINGS, SKETCHES, QUERY_CACHE, MEMORY_PARTS };
+
+// One indexed k-mer occurrence: the genome's slot in the genome table and
+// the position of the k-mer in it.  The match length is always the
+// minimum search length, and names are only looked up for results.
+struct Posting
+{
+	uint32_t genomeId;
+	uint32_t position;
+};
+static_assert(numeric_limits<int>::max() <= numeric_limits<uint32_t>::max(),
+	"a genome's length is an int, so every position must fit in a posting");
+
+bool postingBefore(const Posting& lhs, const Posting& rhs)
+{
+	return lhs.genomeId != rhs.genomeId ? lhs.genomeId < rhs.genomeId : lhs.position < rhs.position;
+}
+
+// A posting extended to the longest match it starts.
+struct Hit
+{
+	uint32_t genomeId;
+	int position;
+	int length;
+};
+
+// Working memory for searches.  A search clears what it uses but keeps the
+// capacity, so a thread that reuses one set of buffers stops allocating
+// once they have grown to fit its queries.
+struct QueryBuffers
+{
+	vector<Hit> hits;
+	vector<Posting> seeds;
+	vector<Posting> secondHalf;
+	vector<int> lengths;                 //extended length of each seed
+	const vector<char>* genomeFilter = nullptr;     //if set, only genomes marked in it are searched
+	PackedSequence fragment;
+	string cacheKey;
+	vector<pair<uint32_t, uint32_t> > fmRows;       //an FM_INDEX search's row ranges
+	  //batch lookups
+	vector<const char*> keys;
+	vector<int> keyIndex;
+	vector<uint32_t> order;
+	vector<const char*> sortedKeys;
+	vector<Posting> postings;
+	vector<pair<uint32_t, uint32_t> > found;
+	  //each segment's hits, when a library has several
+	vector<Hit> segmentHits;
+	vector<int> segmentOffsets;
+	  //a findRelatedGenomes thread's fragments, their cache keys and the
+	  //offsets of their hits; the strings are kept for the next chunk's
+	  //fragments, so they are allocated once
+	vector<string> chunk;
+	vector<string> chunkKeys;
+	vector<int> chunkOffsets;
+	size_t grownStrings = 0;             //times one of those strings grew
+	QueryStats* stats = nullptr;         //if set, searches add what they do to it
+
+	size_t grown();
+private:
+	static const int BUFFERS = 17;
+	size_t m_capacities[BUFFERS] = {};
+	size_t m_fragmentAllocations = 0;
+};
+
+// How many buffers have grown since the last call, which is how many
+// allocations searches made in the meantime unless one grew twice.
+size_t QueryBuffers::grown()
+{
+	const size_t capacities[BUFFERS] = { hits.capacity(), seeds.capacity(), secondHalf.capacity(), lengths.capacity(),
+		cacheKey.capacity(), fmRows.capacity(), keys.capacity(), keyIndex.capacity(), order.capacity(),
+		sortedKeys.capacity(), postings.capacity(), found.capacity(), segmentHits.capacity(), segmentOffsets.capacity(),
+		chunk.capacity(), chunkKeys.capacity(), chunkOffsets.capacity() };
+	size_t count = fragment.allocations() - m_fragmentAllocations + grownStrings;
+	m_fragmentAllocations = fragment.allocations();
+	grownStrings = 0;
+	for (int i = 0; i != BUFFERS; i++)
+	{
+		count += capacities[i] != m_capacities[i];
+		m_capacities[i] = capacities[i];
+	}
+	return count;
+}
+
+// Adds the time since it was made, or since the last lap, to one of the
+// phase times of a QueryStats.  Without a QueryStats it never reads the
+// clock.
+class PhaseTimer
 {
 public:
-    GenomeMatcherImpl(int minSearchLength);
-    void addGenome(const Genome& genome);
-    int minimumSearchLength() const;
-    bool findGenomesWithThisDNA(const string& fragment, int minimumLength, 
-		bool exactMatchOnly, vector<DNAMatch>& matches) const;
-    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength,
-		bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+	explicit PhaseTimer(QueryStats* stats);
+	void lap(double QueryStats::* phase);
+private:
+	QueryStats* m_stats;
+	chrono::steady_clock::time_point m_last;
+};
+
+PhaseTimer::PhaseTimer(QueryStats* stats)
+	:m_stats(stats)
+{
+	if (m_stats != nullptr)
+		m_last = chrono::steady_clock::now();
+}
+
+void PhaseTimer::lap(double QueryStats::* phase)
+{
+	if (m_stats == nullptr)
+		return;
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	m_stats->*phase += chrono::duration<double>(now - m_last).count();
+	m_last = now;
+}
+
+void addStats(QueryStats& to, const QueryStats& from)
+{
+	to.queries += from.queries;
+	to.cacheHits += from.cacheHits;
+	to.trieNodes += from.trieNodes;
+	to.postings += from.postings;
+	to.basesCompared += from.basesCompared;
+	to.allocations += from.allocations;
+	to.lookupSeconds += from.lookupSeconds;
+	to.candidateSeconds += from.candidateSeconds;
+	to.extendSeconds += from.extendSeconds;
+	to.groupSeconds += from.groupSeconds;
+}
 
+bool validQuery(const string& fragment, int minimumLength, int searchMin)
+{
+	if ((int)fragment.size() < minimumLength || minimumLength < searchMin || minimumLength < 0)
+		return false;
+	return fragment.find_first_not_of("ACGTN") == string::npos;    //packing would turn other characters into Ns
+}
+
+// A run of genomes with consecutive IDs, with their sketches and an index
+// over just them.  A segment never changes once a library holds it: adding
+// genomes makes a new segment, and merging segments makes another out of
+// their genomes.  Postings hold library-wide genome IDs, so the hits of
+// every segment can be counted and named alike.
+class Segment
+{
+public:
+	Segment(int searchMin, GenomeMatcher::IndexType indexType, uint32_t firstId);
+	  // Makes the segment hold the genomes of parts, consecutive segments in
+	  // ID order, and then genomes, indexing these on threads threads.
+	void build(const vector<const Segment*>& parts, const vector<Genome>& genomes, int threads);
+	void compact(const Segment& segment, const vector<char>& live);
+	void save(IndexWriter& out) const;
+	bool load(IndexReader& in, size_t genomeCount, const shared_ptr<const MappedFile>& file);
+	uint32_t firstId() const;
+	uint32_t genomeCount() const;
+	size_t bases() const;
+	size_t windowsWithN() const;         // of m_searchMin bases
+	size_t kmerOccurrences() const;      // what a KmerIndex stores
+	size_t removedBases(const vector<char>& live) const;
+	const Genome& genome(uint32_t id) const;
+	bool findHits(const string& fragment, int minimumLength, bool exactMatchOnly, vector<Hit>& hits,
+		QueryBuffers& buffers) const;
+	  // Appends the hits of every fragment to hits and their offsets to
+	  // offsets, fragments.size() + 1 of them.
+	void findHitsBatch(const vector<string>& fragments, int minimumLength, bool exactMatchOnly,
+		vector<Hit>& hits, vector<int>& offsets, QueryBuffers& buffers) const;
+	  // Sets shared[id] for each of the segment's genomes to the number of
+	  // hashes its sketch shares with query.
+	void countShared(const Sketch& query, vector<int>& shared) const;
+	void countMemory(MemoryTally parts[MEMORY_PARTS]) const;
 private:
 	int m_searchMin;
-	vector<Genome> m_genomeVec;
-	Trie<DNAMatch> m_genomeData;
-	void longestFragmentHelper(DNAMatch& curMatch, const Genome* curGenome, const string& fragment,
-		string& genomePart, string& fragPart, bool b, bool snip) const;
+	GenomeMatcher::IndexType m_indexType;
+	uint32_t m_firstId;
+	size_t m_bases;
+	size_t m_windowsWithN;
+	vector<Genome> m_genomes;            //genome m_firstId + i is m_genomes[i]
+	vector<Sketch> m_sketches;           //and this is its sketch
+	SketchIndex m_sketchIndex;
+	Trie<Posting> m_genomeData;          //only used by TRIE_INDEX
+	FMIndex m_fmIndex;                   //only used by FM_INDEX
+	KmerIndex m_kmerIndex;               //only used by HASH_INDEX and MINIMIZER_INDEX
+	vector<shared_ptr<const MappedFile> > m_files;   //the index files its genomes and arrays view, if any
+
+	bool hashedIndex() const;
+	void indexSketches();
+	void buildIndex();
+	void indexGenomes(const vector<Genome>& genomes, uint32_t firstId, Trie<Posting>& index, int threads) const;
+	void findSeeds(const string& fragment, int seedLength, bool exactMatchOnly, QueryBuffers& buffers) const;
+	void indexGenome(const Genome& genome, uint32_t id, Trie<Posting>& index, int from, int to) const;
+	bool extendSeeds(const string& fragment, int minimumLength, bool exactMatchOnly,
+		vector<Posting>& someMatches, vector<Hit>& hits, QueryBuffers& buffers) const;
+	void joinHalves(const string& fragment, const Posting* secondHalf, size_t count, vector<Posting>& seeds) const;
+	void sampledSeeds(const string& fragment, vector<Posting>& seeds) const;
 };
 
-GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength)
-	:m_searchMin(minSearchLength)
+Segment::Segment(int searchMin, GenomeMatcher::IndexType indexType, uint32_t firstId)
+	:m_searchMin(searchMin), m_indexType(indexType), m_firstId(firstId), m_bases(0), m_windowsWithN(0)
 {}
 
+uint32_t Segment::firstId() const
+{
+	return m_firstId;
+}
+
+uint32_t Segment::genomeCount() const
+{
+	return m_genomes.size();
+}
+
+size_t Segment::bases() const
+{
+	return m_bases;
+}
+
+size_t Segment::windowsWithN() const
+{
+	return m_windowsWithN;
+}
+
+size_t Segment::kmerOccurrences() const
+{
+	return m_kmerIndex.occurrenceCount();
+}
+
+// The bases of the genomes live marks removed that are still indexed.
+size_t Segment::removedBases(const vector<char>& live) const
+{
+	size_t removed = 0;
+	for (size_t i = 0; i != m_genomes.size(); i++)
+	{
+		if (!live[m_firstId + i])
+			removed += m_genomes[i].length();
+	}
+	return removed;
+}
+
+const Genome& Segment::genome(uint32_t id) const
+{
+	return m_genomes[id - m_firstId];
+}
+
+// Whether the index is a KmerIndex, sampled or not.
+bool Segment::hashedIndex() const
+{
+	return m_indexType == GenomeMatcher::HASH_INDEX || m_indexType == GenomeMatcher::MINIMIZER_INDEX;
+}
 
-void GenomeMatcherImpl::addGenome(const Genome& genome)
+// The parts' tries are laid over each other, which holds the same postings
+// in the same order as indexing their genomes again would, and the new
+// genomes' trie is laid over them.  The other indexes are rebuilt from
+// every genome.
+void Segment::build(const vector<const Segment*>& parts, const vector<Genome>& genomes, int threads)
 {
-	m_genomeVec.push_back(genome);
-	int size = genome.length();
-	for (int i = 0; i <= size - m_searchMin; i++) 
+	for (const Segment* s : parts)
 	{
-		DNAMatch newDNA;          //create a new dnamatch for each fragment
-		newDNA.genomeName = genome.name();
-		newDNA.position = i;
-		newDNA.length = m_searchMin;
-		string frag;
-		if (genome.extract(i, m_searchMin, frag)) {
-			m_genomeData.insert(frag, newDNA);
-			//cerr << "inserted " << frag << endl;
+		m_genomes.insert(m_genomes.end(), s->m_genomes.begin(), s->m_genomes.end());
+		m_sketches.insert(m_sketches.end(), s->m_sketches.begin(), s->m_sketches.end());
+		for (const shared_ptr<const MappedFile>& f : s->m_files)     //an opened genome still views its file
+		{
+			if (find(m_files.begin(), m_files.end(), f) == m_files.end())
+				m_files.push_back(f);
 		}
 	}
+	const uint32_t firstAdded = m_firstId + m_genomes.size();
+	m_genomes.insert(m_genomes.end(), genomes.begin(), genomes.end());
+	m_sketches.resize(m_genomes.size());
+	for (size_t i = 0; i != genomes.size(); i++)
+		m_sketches[firstAdded - m_firstId + i].build(genomes[i].sequence());
+	indexSketches();
+	if (m_indexType != GenomeMatcher::TRIE_INDEX)
+	{
+		buildIndex();
+		return;
+	}
+	for (const Segment* s : parts)
+		m_genomeData.merge(s->m_genomeData);
+	if (genomes.empty())
+		return;
+	Trie<Posting> added;
+	indexGenomes(genomes, firstAdded, added, threads);
+	if (parts.empty())
+		m_genomeData.swap(added);
+	else
+		m_genomeData.merge(added);
 }
 
-int GenomeMatcherImpl::minimumSearchLength() const
+// Makes this segment a copy of segment without the genomes live marks
+// removed.  They keep their slots, as empty genomes that have no postings,
+// so the genome IDs stay the same.
+void Segment::compact(const Segment& segment, const vector<char>& live)
 {
-	return m_searchMin;
+	vector<Genome> genomes = segment.m_genomes;
+	for (size_t i = 0; i != genomes.size(); i++)
+	{
+		if (!live[m_firstId + i])
+			genomes[i] = Genome("", "");
+	}
+	m_files = segment.m_files;
+	build(vector<const Segment*>(), genomes, 0);
 }
 
-bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength,
-	bool exactMatchOnly, vector<DNAMatch>& matches) const
+// Counts the bases of the genomes and indexes their sketches.
+void Segment::indexSketches()
 {
-	const int fsize = fragment.size();
-	const int genomeVecSize = m_genomeVec.size();
-	if (fsize < minimumLength || minimumLength < m_searchMin || minimumLength < 0)
+	m_bases = 0;
+	m_windowsWithN = 0;
+	for (const Genome& g : m_genomes)
+	{
+		m_bases += g.length();
+		m_windowsWithN += g.sequence().windowsWithN(m_searchMin);
+	}
+	m_sketchIndex.build(m_sketches);
+}
+
+void Segment::buildIndex()
+{
+	vector<const PackedSequence*> sequences;
+	for (const Genome& g : m_genomes)
+		sequences.push_back(&g.sequence());
+	if (m_indexType == GenomeMatcher::FM_INDEX)
+		m_fmIndex.build(sequences);          //the library checked that they fit
+	else if (m_indexType == GenomeMatcher::HASH_INDEX)
+		m_kmerIndex.build(sequences, m_searchMin);
+	else
+	{
+		  //k-mers of half the search length, but at least MINIMIZER_MIN bases
+		  //so they stay selective, sampled from windows that fit in it
+		int keyLength = min(m_searchMin, max(MINIMIZER_MIN, (m_searchMin + 1) / 2));
+		keyLength = min(keyLength, (int)MINIMIZER_MAX);
+		m_kmerIndex.build(sequences, keyLength, m_searchMin - keyLength + 1);
+	}
+}
+
+// Builds the postings for genomes, the first of which has ID firstId, into
+// the empty trie index on several threads.  The k-mer positions, taken in
+// genome order, are split into one run of about the same length per
+// thread, and each thread indexes its run into a private trie.
+// Neighbouring tries are then merged pairwise, a round of pairs at a time
+// on as many threads, until one is left.  A key's postings from a later
+// run go after the earlier run's, so the result is exactly the trie a
+// serial build would give.
+void Segment::indexGenomes(const vector<Genome>& genomes, uint32_t firstId, Trie<Posting>& index, int threads) const
+{
+	vector<size_t> firstKmer(genomes.size() + 1, 0);     //k-mers of the genomes before each
+	for (size_t g = 0; g != genomes.size(); g++)
+		firstKmer[g + 1] = firstKmer[g] + max(0, genomes[g].length() - m_searchMin + 1);
+	const size_t kmers = firstKmer.back();
+	if (threads <= 0)
+		threads = thread::hardware_concurrency();
+	threads = (int)max<size_t>(1, min<size_t>(threads, kmers));
+	if (threads == 1)
+	{
+		for (size_t g = 0; g != genomes.size(); g++)
+			indexGenome(genomes[g], firstId + g, index, 0, (int)(firstKmer[g + 1] - firstKmer[g]));
+		return;
+	}
+
+	vector<Trie<Posting> > parts(threads);
+	vector<thread> workers;
+	for (int t = 0; t != threads; t++)
+	{
+		workers.push_back(thread([this, &genomes, &firstKmer, &parts, firstId, kmers, t, threads]() {
+			const size_t from = kmers * t / threads;
+			const size_t to = kmers * (t + 1) / threads;
+			size_t g = upper_bound(firstKmer.begin(), firstKmer.end(), from) - firstKmer.begin() - 1;
+			for (; g != genomes.size() && firstKmer[g] < to; g++)
+			{
+				int start = (int)(max(from, firstKmer[g]) - firstKmer[g]);
+				int end = (int)(min(to, firstKmer[g + 1]) - firstKmer[g]);
+				indexGenome(genomes[g], firstId + g, parts[t], start, end);
+			}
+		}));
+	}
+	for (thread& w : workers)
+		w.join();
+	for (int step = 1; step < threads; step *= 2)
+	{
+		workers.clear();
+		for (int t = 0; t + step < threads; t += 2 * step)
+		{
+			workers.push_back(thread([&parts, t, step]() {
+				parts[t].merge(parts[t + step]);
+				parts[t + step].reset();
+			}));
+		}
+		for (thread& w : workers)
+			w.join();
+	}
+	index.swap(parts[0]);
+}
+
+// Indexes the k-mers of genome that start at positions from up to to.
+void Segment::indexGenome(const Genome& genome, uint32_t id, Trie<Posting>& index, int from, int to) const
+{
+	if (from >= to)
+		return;
+	string bases;
+	genome.extract(from, to - from + m_searchMin - 1, bases);
+	string frag;
+	for (int i = from; i != to; i++)
+	{
+		Posting newPosting;          //create a new posting for each fragment
+		newPosting.genomeId = id;
+		newPosting.position = i;
+		frag.assign(bases, i - from, m_searchMin);
+		index.insert(frag, newPosting);
+	}
+}
+
+// Each genome's name and packed sequence, then each genome's sketch, then
+// the index.
+void Segment::save(IndexWriter& out) const
+{
+	for (const Genome& g : m_genomes)
+	{
+		string name = g.name();
+		out.array(name.data(), name.size());
+		g.sequence().save(out);
+	}
+	for (const Sketch& s : m_sketches)
+		s.save(out);
+	if (m_indexType == GenomeMatcher::FM_INDEX)
+		m_fmIndex.save(out);
+	else if (hashedIndex())
+		m_kmerIndex.save(out);
+	else
+		m_genomeData.save(out);
+}
+
+bool Segment::load(IndexReader& in, size_t genomeCount, const shared_ptr<const MappedFile>& file)
+{
+	for (size_t i = 0; i != genomeCount; i++)
+	{
+		Storage<char> name;
+		PackedSequence sequence;
+		if (!in.array(name) || !sequence.load(in))
+			return false;
+		m_genomes.push_back(Genome(string(name.begin(), name.end()), sequence));
+	}
+	m_sketches.resize(genomeCount);
+	for (Sketch& s : m_sketches)
+	{
+		if (!s.load(in))
+			return false;
+	}
+	bool loaded;
+	if (m_indexType == GenomeMatcher::FM_INDEX)
+		loaded = m_fmIndex.load(in);
+	else if (hashedIndex())
+		loaded = m_kmerIndex.load(in) && m_kmerIndex.span() == m_searchMin;
+	else
+		loaded = m_genomeData.load(in);
+	if (!loaded)
 		return false;
+	indexSketches();
+	m_files.push_back(file);
+	return true;
+}
 
-	string minFrag = fragment.substr(0, m_searchMin);  //get the first searchMin bases of the fragment
-	vector<DNAMatch> someMatches = m_genomeData.find(minFrag, exactMatchOnly);     
+bool Segment::findHits(const string& fragment, int minimumLength,
+	bool exactMatchOnly, vector<Hit>& hits, QueryBuffers& buffers) const
+{
+	if (!validQuery(fragment, minimumLength, m_searchMin))
+		return false;
+	vector<Posting>& seeds = buffers.seeds;
+	seeds.clear();
+	PhaseTimer timer(buffers.stats);
+	findSeeds(fragment, minimumLength, exactMatchOnly, buffers);
+	timer.lap(&QueryStats::lookupSeconds);
+	return extendSeeds(fragment, minimumLength, exactMatchOnly, seeds, hits, buffers);
+}
+
+// Runs findHits on each fragment, batching the trie lookups of all of them:
+// the lookup keys are sorted, so fragments that share a prefix walk it
+// together, and handed to the trie in one call.  Hits for fragment i are
+// hits[offsets[i]] to hits[offsets[i + 1] - 1].
+void Segment::findHitsBatch(const vector<string>& fragments, int minimumLength, bool exactMatchOnly,
+	vector<Hit>& hits, vector<int>& offsets, QueryBuffers& buffers) const
+{
+	if (m_indexType != GenomeMatcher::TRIE_INDEX || (!exactMatchOnly && minimumLength < 2 * m_searchMin))
+	{
+		for (const string& fragment : fragments)    //no exact keys to batch
+		{
+			offsets.push_back(hits.size());
+			findHits(fragment, minimumLength, exactMatchOnly, hits, buffers);
+		}
+		offsets.push_back(hits.size());
+		return;
+	}
 
-	//now somematches holds fragment matches of the first searchMin bases, found by the trie
+	PhaseTimer timer(buffers.stats);
+	  //one key per fragment, or two (its halves) for a snip search
+	const int keysPerFragment = exactMatchOnly ? 1 : 2;
+	vector<const char*>& keys = buffers.keys;
+	vector<int>& keyIndex = buffers.keyIndex;
+	keys.clear();
+	keyIndex.assign(fragments.size(), -1);
+	for (size_t q = 0; q != fragments.size(); q++)
+	{
+		if (!validQuery(fragments[q], minimumLength, m_searchMin))
+			continue;
+		keyIndex[q] = keys.size();
+		for (int half = 0; half != keysPerFragment; half++)
+			keys.push_back(fragments[q].data() + half * m_searchMin);
+	}
+	vector<uint32_t>& order = buffers.order;
+	order.resize(keys.size());
+	for (size_t i = 0; i != order.size(); i++)
+		order[i] = i;
+	const size_t keyLength = m_searchMin;
+	sort(order.begin(), order.end(), [&keys, keyLength](uint32_t a, uint32_t b) {
+		return memcmp(keys[a], keys[b], keyLength) < 0;
+	});
+	vector<const char*>& sortedKeys = buffers.sortedKeys;
+	sortedKeys.resize(keys.size());
+	for (size_t i = 0; i != order.size(); i++)
+		sortedKeys[i] = keys[order[i]];
+
+	vector<Posting>& postings = buffers.postings;              //every key's postings, back to back
+	vector<pair<uint32_t, uint32_t> >& found = buffers.found;  //(start, count) by key
+	postings.clear();
+	found.assign(keys.size(), make_pair(0u, 0u));
+	size_t visited = m_genomeData.findBatch(sortedKeys.data(), sortedKeys.size(), keyLength,
+		[&](size_t i, const Posting* values, uint32_t count) {
+			found[order[i]] = make_pair((uint32_t)postings.size(), count);
+			postings.insert(postings.end(), values, values + count);
+		});
+	timer.lap(&QueryStats::lookupSeconds);
+	if (buffers.stats != nullptr)
+		buffers.stats->trieNodes += visited;
+
+	vector<Posting>& seeds = buffers.seeds;
+	for (size_t q = 0; q != fragments.size(); q++)
+	{
+		offsets.push_back(hits.size());
+		if (keyIndex[q] < 0)
+			continue;
+		PhaseTimer candidateTimer(buffers.stats);    //extendSeeds times itself
+		const pair<uint32_t, uint32_t>& first = found[keyIndex[q]];
+		seeds.assign(postings.begin() + first.first, postings.begin() + first.first + first.second);
+		if (!exactMatchOnly)
+		{
+			const pair<uint32_t, uint32_t>& second = found[keyIndex[q] + 1];
+			joinHalves(fragments[q], postings.data() + second.first, second.second, seeds);
+		}
+		candidateTimer.lap(&QueryStats::candidateSeconds);
+		extendSeeds(fragments[q], minimumLength, exactMatchOnly, seeds, hits, buffers);
+	}
+	offsets.push_back(hits.size());
+}
+
+// Extends every seed as far as the fragment allows and keeps each genome's
+// longest match of at least minimumLength bases.
+bool Segment::extendSeeds(const string& fragment, int minimumLength, bool exactMatchOnly,
+	vector<Posting>& someMatches, vector<Hit>& hits, QueryBuffers& buffers) const
+{
+	const int fsize = fragment.size();
+	QueryStats* stats = buffers.stats;
+	PhaseTimer timer(stats);
+	if (stats != nullptr)
+		stats->postings += someMatches.size();
+	if (buffers.genomeFilter != nullptr)      //skip the genomes the prefilter ruled out
+	{
+		const vector<char>& keep = *buffers.genomeFilter;
+		someMatches.erase(remove_if(someMatches.begin(), someMatches.end(), [&keep](const Posting& p) {
+			return !keep[p.genomeId];
+		}), someMatches.end());
+	}
+	//now somematches holds the seeds found by the index
 	int n = someMatches.size();
 	if (n == 0)
+	{
+		timer.lap(&QueryStats::candidateSeconds);
 		return false;
+	}
+	PackedSequence& fragSeq = buffers.fragment;
+	fragSeq.clear();
+	fragSeq.append(fragment.data(), fsize);
+	  //snip searches visit several leaves, so group the postings by genome
+	if (!is_sorted(someMatches.begin(), someMatches.end(), postingBefore))
+		sort(someMatches.begin(), someMatches.end(), postingBefore);
+	timer.lap(&QueryStats::candidateSeconds);
+
+	vector<int>& lengths = buffers.lengths;
+	lengths.resize(n);
 	for (int i = 0; i != n; i++)      //iterate over the matches
 	{
-		DNAMatch* curMatch = &(someMatches[i]);
-		const Genome* curGenome = nullptr;
-		for (int i = 0; i != genomeVecSize; i++) {
-			if (m_genomeVec[i].name() == curMatch->genomeName)
-				curGenome = &m_genomeVec[i];
+		  //the genome ID less the segment's first is the genome's slot in it, so this is a direct lookup
+		const PackedSequence& genomeSeq = genome(someMatches[i].genomeId).sequence();
+		int position = someMatches[i].position;
+		const int limit = min(fsize, genomeSeq.length() - position);
+		  //extend from the start of the seed, so a seed that is already a SNiP uses up the mismatch
+		lengths[i] = PackedSequence::matchLength(genomeSeq, position, fragSeq, 0, limit, exactMatchOnly ? 0 : 1);
+		if (stats != nullptr)             //every base of the match, and the mismatch that ended it
+			stats->basesCompared += min(lengths[i] + 1, limit);
+	}
+	timer.lap(&QueryStats::extendSeconds);
+	//now lengths hold the longest fragments. keep the longest (earliest on ties) of each genome
+	bool found = false;
+	for (int i = 0; i != n; )
+	{
+		uint32_t curId = someMatches[i].genomeId;
+		int best = i;
+		for (; i != n && someMatches[i].genomeId == curId; i++)
+		{
+			if (lengths[i] > lengths[best])
+				best = i;
+		}
+		if (lengths[best] >= minimumLength)
+		{
+			Hit target;
+			target.genomeId = curId;
+			target.length = lengths[best];
+			target.position = someMatches[best].position;
+			hits.push_back(target);
+			found = true;
 		}
+	}
+	timer.lap(&QueryStats::groupSeconds);
+	return found;
+}
+
+// Collects the places a match of at least seedLength bases could start.  The
+// trie only knows minSearchLength-base prefixes, so its seeds still have to
+// be extended, and so do the hash index's, which are the same ones; the
+// FM-index searches the whole seedLength prefix of the fragment, which leaves
+// far fewer seeds for long queries.  Seeds may include places that don't
+// match; findHits verifies every one.
+void Segment::findSeeds(const string& fragment, int seedLength, bool exactMatchOnly,
+	QueryBuffers& buffers) const
+{
+	vector<Posting>& seeds = buffers.seeds;
+	auto addSeed = [this](vector<Posting>& to) {
+		return [this, &to](uint32_t genomeId, uint32_t position) {
+			Posting p;
+			p.genomeId = m_firstId + genomeId;    //the index counts from the segment's first genome
+			p.position = position;
+			to.push_back(p);
+		};
+	};
+	if (m_indexType == GenomeMatcher::FM_INDEX)
+	{
+		m_fmIndex.findSeeds(fragment.data(), seedLength, exactMatchOnly, buffers.fmRows, addSeed(seeds));
+		return;
+	}
+	auto addSeeds = [&seeds](const Posting* postings, uint32_t count) {
+		seeds.insert(seeds.end(), postings, postings + count);
+	};
+	auto countNodes = [&buffers](size_t visited) {
+		if (buffers.stats != nullptr)
+			buffers.stats->trieNodes += visited;
+	};
+	  //look up the first searchMin bases of the fragment
+	if (exactMatchOnly || seedLength < 2 * m_searchMin)
+	{
+		if (hashedIndex())
+			m_kmerIndex.findSeeds(fragment.data(), exactMatchOnly, addSeed(seeds));
+		else
+			countNodes(m_genomeData.find(fragment.data(), m_searchMin, exactMatchOnly, addSeeds));
+		if (m_indexType == GenomeMatcher::MINIMIZER_INDEX)
+			sampledSeeds(fragment, seeds);
+		return;
+	}
+	  //a match of seedLength bases with one SNiP has an exact copy of at least
+	  //one of the first two searchMin-base halves, so two exact lookups find
+	  //every candidate; the extension throws out the ones with more mismatches
+	if (hashedIndex())
+	{
+		vector<Posting>& secondHalf = buffers.secondHalf;
+		secondHalf.clear();
+		m_kmerIndex.findSeeds(fragment.data(), true, addSeed(seeds));
+		m_kmerIndex.findSeeds(fragment.data() + m_searchMin, true, addSeed(secondHalf));
+		joinHalves(fragment, secondHalf.data(), secondHalf.size(), seeds);
+		if (m_indexType == GenomeMatcher::MINIMIZER_INDEX)
+			sampledSeeds(fragment, seeds);
+		return;
+	}
+	countNodes(m_genomeData.find(fragment.data(), m_searchMin, true, addSeeds));
+	countNodes(m_genomeData.find(fragment.data() + m_searchMin, m_searchMin, true, [&](const Posting* postings, uint32_t count) {
+		joinHalves(fragment, postings, count, seeds);      //an exact lookup visits one node at most
+	}));
+}
 
-		string fragPart = minFrag;
-		string genomePart;
-		curGenome->extract(curMatch->position, curMatch->length, genomePart);
-		bool snip = false;
-		if (fragPart != genomePart)
-			snip = true;
-		longestFragmentHelper(someMatches[i], curGenome, fragment, genomePart, fragPart, exactMatchOnly, snip);
+// Adds the seeds found by the fragment's second searchMin-base half to the
+// ones found by its first half.
+void Segment::joinHalves(const string& fragment, const Posting* secondHalf, size_t count,
+	vector<Posting>& seeds) const
+{
+	const size_t firstHalfSeeds = seeds.size();
+	for (size_t i = 0; i != count; i++)
+	{
+		const Posting& p = secondHalf[i];
+		if (p.position < (uint32_t)m_searchMin)
+			continue;
+		Posting shifted = p;
+		shifted.position -= m_searchMin;
+		if (genome(p.genomeId).sequence().at(shifted.position) == fragment[0])    //the first base must match
+			seeds.push_back(shifted);
+	}
+	if (seeds.size() != firstHalfSeeds)        //drop seeds both halves found
+	{
+		sort(seeds.begin(), seeds.end(), postingBefore);
+		seeds.erase(unique(seeds.begin(), seeds.end(), [](const Posting& lhs, const Posting& rhs) {
+			return lhs.genomeId == rhs.genomeId && lhs.position == rhs.position;
+		}), seeds.end());
 	}
-	//now somematches should hold the longest fragments. need to sort
-	DNAMatch curMatch = someMatches[0];
-	string curGenomeName = curMatch.genomeName;
-	bool needToPush = true;
+}
+
+// A sampled index reports every place that shares a minimizer with the
+// fragment, so drop the ones whose first base is already wrong (a snip
+// extension would take it for the mismatch) and the duplicates.
+void Segment::sampledSeeds(const string& fragment, vector<Posting>& seeds) const
+{
+	seeds.erase(remove_if(seeds.begin(), seeds.end(), [this, &fragment](const Posting& p) {
+		return genome(p.genomeId).sequence().at(p.position) != fragment[0];
+	}), seeds.end());
+	sort(seeds.begin(), seeds.end(), postingBefore);
+	seeds.erase(unique(seeds.begin(), seeds.end(), [](const Posting& lhs, const Posting& rhs) {
+		return lhs.genomeId == rhs.genomeId && lhs.position == rhs.position;
+	}), seeds.end());
+}
+
+// The version of the library searches see.  A search takes the current
+// version when it starts and uses it to the end, so genomes added in the
+// meantime can't change what it finds, and nothing it uses is freed until
+// the last search holding the version lets go of it.
+struct Library
+{
+	int searchMin;
+	GenomeMatcher::IndexType indexType;
+	uint64_t version = 0;                //how many versions came before, so cached hits can tell them apart
+	vector<shared_ptr<const Segment> > segments;    //in genome ID order, size classes falling along it bar compacted ones
+	  //by genome ID, 0 for the genomes that have been removed; searches
+	  //skip their postings until their segment is compacted
+	vector<char> live;
+	uint32_t removed = 0;                //genomes live marks 0
+
+	uint32_t genomeCount() const;
+	size_t bases() const;
+	bool fits(const vector<Genome>& genomes) const;
+	const Genome& genome(uint32_t id) const;
+	bool findHits(const string& fragment, int minimumLength, bool exactMatchOnly, vector<Hit>& hits,
+		QueryBuffers& buffers) const;
+	void findHitsBatch(const vector<string>& fragments, int minimumLength, bool exactMatchOnly,
+		vector<Hit>& hits, vector<int>& offsets, QueryBuffers& buffers) const;
+	int relatedCandidates(const Genome& query, int fragmentMatchLength, bool exactMatchOnly,
+		double matchPercentThreshold, vector<char>& candidates) const;
+};
 
-	for ( int i = 0; i != n; i++)
+uint32_t Library::genomeCount() const
+{
+	return segments.empty() ? 0 : segments.back()->firstId() + segments.back()->genomeCount();
+}
+
+size_t Library::bases() const
+{
+	size_t total = 0;
+	for (const shared_ptr<const Segment>& s : segments)
+		total += s->bases();
+	return total;
+}
+
+// Whether the index can hold genomes as well as the library's genomes.
+// Merging segments, and saving, puts every genome in one index, so it's
+// the whole library that has to fit.  Genome IDs are 32-bit, and the
+// bases bound the number of k-mers.  A KmerIndex stores at most one
+// occurrence per window without an N, and puts no more keys than there
+// are windows with one in its trie, so only those are held to a trie's
+// limit.
+bool Library::fits(const vector<Genome>& genomes) const
+{
+	const size_t sequences = genomeCount() + genomes.size();
+	if (sequences >= numeric_limits<uint32_t>::max())
+		return false;
+	size_t total = bases();
+	for (const Genome& g : genomes)
+		total += g.length();
+	if (indexType == GenomeMatcher::FM_INDEX)
+		return FMIndex::fits(sequences, total);
+	if (indexType == GenomeMatcher::TRIE_INDEX)
+		return Trie<Posting>::fits(total, searchMin);
+	size_t occurrences = 0;
+	size_t nKeys = 0;
+	for (const shared_ptr<const Segment>& s : segments)
 	{
-		while (i != n && someMatches[i].genomeName == curGenomeName)
+		occurrences += s->kmerOccurrences();
+		nKeys += s->windowsWithN();
+	}
+	for (const Genome& g : genomes)
+	{
+		int withN = g.sequence().windowsWithN(searchMin);
+		occurrences += max(0, g.length() - searchMin + 1) - withN;
+		nKeys += withN;
+	}
+	return KmerIndex::fits(occurrences, nKeys, searchMin);
+}
+
+const Genome& Library::genome(uint32_t id) const
+{
+	auto s = upper_bound(segments.begin(), segments.end(), id, [](uint32_t target, const shared_ptr<const Segment>& s) {
+		return target < s->firstId();
+	});
+	return (*(s - 1))->genome(id);
+}
+
+// The segments hold ascending genome IDs, so their hits come out in the
+// order a single index would give.
+bool Library::findHits(const string& fragment, int minimumLength, bool exactMatchOnly, vector<Hit>& hits,
+	QueryBuffers& buffers) const
+{
+	bool found = false;
+	for (const shared_ptr<const Segment>& s : segments)
+		found |= s->findHits(fragment, minimumLength, exactMatchOnly, hits, buffers);
+	return found;
+}
+
+// Hits for fragment i are hits[offsets[i]] to hits[offsets[i + 1] - 1].
+void Library::findHitsBatch(const vector<string>& fragments, int minimumLength, bool exactMatchOnly,
+	vector<Hit>& hits, vector<int>& offsets, QueryBuffers& buffers) const
+{
+	offsets.clear();
+	if (segments.size() == 1)
+	{
+		segments[0]->findHitsBatch(fragments, minimumLength, exactMatchOnly, hits, offsets, buffers);
+		return;
+	}
+	  //search segment by segment, then gather each fragment's hits from all of them
+	vector<Hit>& found = buffers.segmentHits;
+	vector<int>& foundOffsets = buffers.segmentOffsets;
+	found.clear();
+	foundOffsets.clear();
+	for (const shared_ptr<const Segment>& s : segments)
+		s->findHitsBatch(fragments, minimumLength, exactMatchOnly, found, foundOffsets, buffers);
+	const size_t stride = fragments.size() + 1;
+	for (size_t q = 0; q != fragments.size(); q++)
+	{
+		offsets.push_back(hits.size());
+		for (size_t s = 0; s != segments.size(); s++)
 		{
-			if (someMatches[i].length > curMatch.length)
-				curMatch = someMatches[i];
-			i++;
+			const int* range = &foundOffsets[s * stride + q];
+			hits.insert(hits.end(), found.begin() + range[0], found.begin() + range[1]);
 		}
-		DNAMatch target = curMatch;
-		if (target.length >= minimumLength) 
-			matches.push_back(target);
-		if (i == n) {
-			needToPush = false;
+	}
+	offsets.push_back(hits.size());
+}
+
+// Marks the genomes whose sketches share enough with the query's that
+// matchPercentThreshold percent of its fragments might match them, and
+// returns how many there are.  Each fragment that matches contributes at
+// least its k-mers that don't overlap the mismatch, so the query shares at
+// least that many k-mers with a genome that reaches the threshold, and
+// about 1 / SCALE of those hashes are in both sketches.  Genomes more than
+// three standard deviations below that are left out.  With fragments too
+// short to be sure of any k-mers, every genome is a candidate.
+int Library::relatedCandidates(const Genome& query, int fragmentMatchLength, bool exactMatchOnly,
+	double matchPercentThreshold, vector<char>& candidates) const
+{
+	candidates = live;
+	const int liveCount = genomeCount() - removed;
+	const int k = Sketch::KMER_LENGTH;
+	const int kmersPerFragment = exactMatchOnly ? fragmentMatchLength - k + 1 : fragmentMatchLength - 2 * k + 1;
+	const int queryKmers = query.length() - k + 1;
+	if (kmersPerFragment <= 0 || queryKmers <= 0)
+		return liveCount;
+	const int num = query.length() / fragmentMatchLength;
+	const double neededFragments = max(1.0, ceil(matchPercentThreshold / 100 * num));
+	const double containment = min(1.0, neededFragments * kmersPerFragment / queryKmers);
+
+	Sketch querySketch;
+	querySketch.build(query.sequence());
+	const double expected = containment * querySketch.size();
+	const double lowest = expected - 3 * sqrt(expected);
+	if (lowest <= 0)
+		return liveCount;
+	vector<int> shared(genomeCount(), 0);
+	for (const shared_ptr<const Segment>& s : segments)
+		s->countShared(querySketch, shared);
+	int count = 0;
+	for (size_t id = 0; id != candidates.size(); id++)
+	{
+		candidates[id] = live[id] && shared[id] >= lowest;
+		count += candidates[id];
+	}
+	return count;
+}
+
+class GenomeMatcherImpl
+{
+public:
+    GenomeMatcherImpl(int minSearchLength, GenomeMatcher::IndexType indexType);
+    bool addGenome(Genome&& genome);
+    bool addGenomes(const vector<Genome>& genomes, int threads);
+    bool removeGenome(const string& name);
+    bool replaceGenome(const Genome& genome);
+    void compact();
+    bool save(const string& indexPath) const;
+    bool open(const string& indexPath, bool verifyChecksum);
+    int minimumSearchLength() const;
+    bool findGenomesWithThisDNA(const string& fragment, int minimumLength,
+		bool exactMatchOnly, vector<DNAMatch>& matches, QueryStats* stats) const;
+    bool findGenomesWithThisDNA(const vector<string>& fragments, int minimumLength,
+		bool exactMatchOnly, vector<DNAMatch>& matches, vector<int>& offsets) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength,
+		bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, int threads, bool prefilter,
+		QueryStats* stats) const;
+    void setQueryCacheSize(size_t fragments);
+    QueryCacheStats queryCacheStats() const;
+    MemoryUsage memoryUsage() const;
+    MemoryUsage projectedMemoryUsage(size_t moreBases) const;
+
+private:
+	  //the current version, only read and replaced with atomic_load and
+	  //atomic_store, so searches never wait for a change to finish
+	shared_ptr<const Library> m_library;
+	mutex m_changeMutex;                 //held by changes, one at a time
+	mutable QueryCache<vector<Hit> > m_queryCache;    //each fragment's hits in a version of the library
+	shared_ptr<const Library> library() const;
+	void publish(const shared_ptr<Library>& next);
+	void addSegment(Library& next, const vector<Genome>& genomes, int threads) const;
+	int removeNamed(Library& next, const string& name) const;
+	bool compactSegments(Library& next, double fraction) const;
+	void cacheKey(const Library& library, const string& fragment, int minimumLength, bool exactMatchOnly,
+		string& key) const;
+	void countMemory(const Library& library, MemoryTally parts[MEMORY_PARTS]) const;
+};
+
+GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength, GenomeMatcher::IndexType indexType)
+	:m_queryCache(QUERY_CACHE_SIZE)
+{
+	if (indexType == GenomeMatcher::HASH_INDEX && minSearchLength > KmerIndex::MAX_KEY_LENGTH)
+		indexType = GenomeMatcher::TRIE_INDEX;     //the k-mers don't fit in a code
+	shared_ptr<Library> empty = make_shared<Library>();
+	empty->searchMin = minSearchLength;
+	empty->indexType = indexType;
+	m_library = empty;
+}
+
+shared_ptr<const Library> GenomeMatcherImpl::library() const
+{
+	return atomic_load(&m_library);
+}
+
+// Replaces the current version.  Searches still using the old one carry
+// on with it; the cache is emptied, and anything they add to it afterwards
+// is keyed by the old version, so no later search finds it.
+void GenomeMatcherImpl::publish(const shared_ptr<Library>& next)
+{
+	atomic_store(&m_library, shared_ptr<const Library>(next));
+	m_queryCache.clear();
+}
+
+bool GenomeMatcherImpl::addGenome(Genome&& genome)
+{
+	vector<Genome> genomes;
+	genomes.push_back(move(genome));
+	return addGenomes(genomes, 1);
+}
+
+// The genomes get a segment of their own, unless that would be bigger
+// than the newest segments, which then make one with them.  Segments are
+// merged a size class at a time: once there are MERGE_FANOUT of a class,
+// they make one of a bigger class.  So the classes fall going back from
+// the newest, with fewer than MERGE_FANOUT segments in each for a search
+// to visit, and each base is merged again only log base MERGE_FANOUT
+// times however the library was built up.  Searches go on using the
+// current version all the while.
+bool GenomeMatcherImpl::addGenomes(const vector<Genome>& genomes, int threads)
+{
+	if (genomes.empty())
+		return true;
+	lock_guard<mutex> lock(m_changeMutex);
+	shared_ptr<const Library> current = library();
+	if (!current->fits(genomes))
+		return false;
+	shared_ptr<Library> next = make_shared<Library>(*current);
+	next->version++;
+	addSegment(*next, genomes, threads);
+	publish(next);
+	return true;
+}
+
+// Segments of one class are within a factor of MERGE_FANOUT in size.
+int sizeClass(size_t bases)
+{
+	int result = 0;
+	for (; bases >= MERGE_FANOUT; bases /= MERGE_FANOUT)
+		result++;
+	return result;
+}
+
+void GenomeMatcherImpl::addSegment(Library& next, const vector<Genome>& genomes, int threads) const
+{
+	vector<shared_ptr<const Segment> >& segments = next.segments;
+	size_t bases = 0;
+	for (const Genome& g : genomes)
+		bases += g.length();
+	size_t first = segments.size();     //the newest segments of a smaller class than the new one join it
+	while (first != 0 && sizeClass(segments[first - 1]->bases()) < sizeClass(bases))
+		bases += segments[--first]->bases();
+	vector<const Segment*> parts;
+	for (size_t i = first; i != segments.size(); i++)
+		parts.push_back(segments[i].get());
+	shared_ptr<Segment> added = make_shared<Segment>(next.searchMin, next.indexType,
+		parts.empty() ? next.genomeCount() : parts[0]->firstId());
+	added->build(parts, genomes, threads);
+	segments.resize(first);
+	segments.push_back(added);
+	next.live.resize(next.live.size() + genomes.size(), 1);
+	while (segments.size() >= MERGE_FANOUT)
+	{
+		first = segments.size() - MERGE_FANOUT;
+		const int newest = sizeClass(segments.back()->bases());
+		parts.clear();
+		for (size_t i = first; i != segments.size(); i++)
+		{
+			if (sizeClass(segments[i]->bases()) == newest)
+				parts.push_back(segments[i].get());
+		}
+		if (parts.size() != MERGE_FANOUT)
 			break;
+		shared_ptr<Segment> merged = make_shared<Segment>(next.searchMin, next.indexType, parts[0]->firstId());
+		merged->build(parts, vector<Genome>(), 1);
+		segments.resize(first);
+		segments.push_back(merged);
+	}
+}
+
+// Removing a genome only marks it, which takes time in proportion to the
+// number of genomes rather than their bases.  The segments are compacted
+// once enough of them is removed, so the work of rebuilding one is at most
+// a few times that of indexing the genomes removed from it.
+bool GenomeMatcherImpl::removeGenome(const string& name)
+{
+	lock_guard<mutex> lock(m_changeMutex);
+	shared_ptr<Library> next = make_shared<Library>(*library());
+	if (removeNamed(*next, name) == 0)
+		return false;
+	next->version++;
+	compactSegments(*next, COMPACT_FRACTION);
+	publish(next);
+	return true;
+}
+
+// Removing and adding in one version means no search sees the library
+// without either genome.
+bool GenomeMatcherImpl::replaceGenome(const Genome& genome)
+{
+	lock_guard<mutex> lock(m_changeMutex);
+	shared_ptr<const Library> current = library();
+	vector<Genome> added(1, genome);
+	if (!current->fits(added))
+		return false;
+	shared_ptr<Library> next = make_shared<Library>(*current);
+	next->version++;
+	bool replaced = removeNamed(*next, genome.name()) != 0;
+	addSegment(*next, added, 1);
+	compactSegments(*next, COMPACT_FRACTION);
+	publish(next);
+	return replaced;
+}
+
+void GenomeMatcherImpl::compact()
+{
+	lock_guard<mutex> lock(m_changeMutex);
+	shared_ptr<Library> next = make_shared<Library>(*library());
+	next->version++;
+	if (compactSegments(*next, 0))
+		publish(next);
+}
+
+// Marks every live genome called name removed and returns how many there
+// were.
+int GenomeMatcherImpl::removeNamed(Library& next, const string& name) const
+{
+	int count = 0;
+	for (const shared_ptr<const Segment>& s : next.segments)
+	{
+		for (uint32_t id = s->firstId(); id != s->firstId() + s->genomeCount(); id++)
+		{
+			if (next.live[id] && s->genome(id).name() == name)
+			{
+				next.live[id] = 0;
+				count++;
+			}
 		}
-		curMatch = someMatches[i];
-		curGenomeName = someMatches[i].genomeName;
 	}
-	if (needToPush) 
+	next.removed += count;
+	return count;
+}
+
+// Replaces each segment more than fraction of whose bases are removed ones
+// with a compacted copy, and returns whether there were any.
+bool GenomeMatcherImpl::compactSegments(Library& next, double fraction) const
+{
+	bool compacted = false;
+	for (shared_ptr<const Segment>& s : next.segments)
 	{
-		DNAMatch target = curMatch;
-		if (target.length >= minimumLength)
-			matches.push_back(target);
+		size_t removedBases = s->removedBases(next.live);
+		if (removedBases == 0 || removedBases <= fraction * s->bases())
+			continue;
+		shared_ptr<Segment> kept = make_shared<Segment>(next.searchMin, next.indexType, s->firstId());
+		kept->compact(*s, next.live);
+		s = kept;
+		compacted = true;
 	}
-	return matches.size() > 0;
+	return compacted;
 }
 
-void GenomeMatcherImpl::longestFragmentHelper(DNAMatch& curMatch, const Genome* curGenome, const string& fragment, 
-	string& genomePart, string& fragPart, bool b, bool snip) const
+// The index file holds the settings and which genomes are live, then the
+// library as one segment.
+bool GenomeMatcherImpl::save(const string& indexPath) const
 {
-	if (fragPart != genomePart) {
-		snip = true;
-		b = true;
+	shared_ptr<const Library> current = library();
+	Segment whole(current->searchMin, current->indexType, 0);
+	const Segment* saved = &whole;
+	if (current->segments.size() == 1)
+		saved = current->segments[0].get();
+	else if (current->segments.size() > 1)
+	{
+		vector<const Segment*> parts;
+		for (const shared_ptr<const Segment>& s : current->segments)
+			parts.push_back(s.get());
+		whole.build(parts, vector<Genome>(), 1);
 	}
-	int fsize = fragment.size();
-	int length = curMatch.length;
+	IndexWriter out;
+	if (!out.open(indexPath))
+		return false;
+	out.value(current->searchMin);
+	out.value(current->indexType);
+	out.value((size_t)current->genomeCount());
+	out.array(current->live.data(), current->live.size());
+	saved->save(out);
+	return out.finish();
+}
 
-	if (length < fsize)
-		fragPart += fragment[length];      //get the next base of the fragment
-	else 
-		return;
-	
-	if (curGenome == nullptr || !curGenome->extract(curMatch.position, length + 1, genomePart))  //get the next base from the genome
-		genomePart = "";
-	if (genomePart[length] == fragPart[length] || (snip && !b) || !b)        //matches
+bool GenomeMatcherImpl::open(const string& indexPath, bool verifyChecksum)
+{
+	shared_ptr<MappedFile> file = make_shared<MappedFile>();
+	if (!file->open(indexPath))
+		return false;
+	IndexReader in(*file);
+	int searchMin;
+	int indexType;
+	size_t genomeCount;
+	if (!in.start(verifyChecksum) || !in.value(searchMin) || !in.value(indexType) || !in.value(genomeCount)
+		|| searchMin <= 0 || indexType < GenomeMatcher::TRIE_INDEX || indexType > GenomeMatcher::MINIMIZER_INDEX)
+		return false;
+	Storage<char> live;
+	if (!in.array(live) || live.size() != genomeCount)
+		return false;
+	shared_ptr<Segment> segment = make_shared<Segment>(searchMin, (GenomeMatcher::IndexType)indexType, 0);
+	if (!segment->load(in, genomeCount, file))
+		return false;
+	if (!in.atEnd())
+		return false;
+
+	  //everything checked out, so switch over to the file
+	lock_guard<mutex> lock(m_changeMutex);
+	shared_ptr<Library> next = make_shared<Library>();
+	next->searchMin = searchMin;
+	next->indexType = (GenomeMatcher::IndexType)indexType;
+	next->version = library()->version + 1;
+	if (genomeCount != 0)
+		next->segments.push_back(segment);
+	next->live.assign(live.begin(), live.end());
+	next->removed = count(live.begin(), live.end(), 0);
+	publish(next);
+	return true;
+}
+
+int GenomeMatcherImpl::minimumSearchLength() const
+{
+	return library()->searchMin;
+}
+
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength,
+	bool exactMatchOnly, vector<DNAMatch>& matches, QueryStats* stats) const
+{
+	thread_local QueryBuffers buffers;     //reused by this thread's later searches
+	vector<Hit>& hits = buffers.hits;
+	hits.clear();
+	if (stats != nullptr)
+	{
+		*stats = QueryStats();
+		stats->queries = 1;
+		buffers.grown();                 //only count what this search grows
+	}
+	shared_ptr<const Library> current = library();
+	if (!validQuery(fragment, minimumLength, current->searchMin))
+		return false;
+	buffers.stats = stats;
+	if (current->removed != 0)
+		buffers.genomeFilter = &current->live;
+	PhaseTimer timer(stats);
+	const bool caching = m_queryCache.capacity() != 0;
+	size_t cacheAllocations = 0;
+	if (caching)
+		cacheKey(*current, fragment, minimumLength, exactMatchOnly, buffers.cacheKey);
+	if (caching && m_queryCache.find(buffers.cacheKey, [&hits](const vector<Hit>& cached) { hits = cached; }))
+	{
+		timer.lap(&QueryStats::lookupSeconds);
+		if (stats != nullptr)
+			stats->cacheHits = 1;
+	}
+	else
+	{
+		current->findHits(fragment, minimumLength, exactMatchOnly, hits, buffers);
+		if (caching)                     //no hits is worth remembering too
+			cacheAllocations = m_queryCache.insert(buffers.cacheKey, hits) + !hits.empty();
+	}
+	buffers.stats = nullptr;
+	buffers.genomeFilter = nullptr;
+	if (stats != nullptr)
+		stats->allocations = buffers.grown() + cacheAllocations;
+	for (const Hit& h : hits)        //names are only looked up for the genomes that matched
+	{
+		DNAMatch target;
+		target.genomeName = current->genome(h.genomeId).name();
+		target.length = h.length;
+		target.position = h.position;
+		matches.push_back(target);
+	}
+	return matches.size() > 0;
+}
+
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const vector<string>& fragments, int minimumLength,
+	bool exactMatchOnly, vector<DNAMatch>& matches, vector<int>& offsets) const
+{
+	thread_local QueryBuffers buffers;
+	vector<Hit>& hits = buffers.hits;
+	hits.clear();
+	shared_ptr<const Library> current = library();
+	if (current->removed != 0)
+		buffers.genomeFilter = &current->live;
+	current->findHitsBatch(fragments, minimumLength, exactMatchOnly, hits, offsets, buffers);
+	buffers.genomeFilter = nullptr;
+	matches.clear();
+	matches.reserve(hits.size());
+	for (const Hit& h : hits)
 	{
-		if (genomePart[length] != fragPart[length])
-			b = true;
-		curMatch.length++;                      //increase length info
-		longestFragmentHelper(curMatch, curGenome, fragment, genomePart, fragPart, b, snip);
+		DNAMatch target;
+		target.genomeName = current->genome(h.genomeId).name();
+		target.length = h.length;
+		target.position = h.position;
+		matches.push_back(target);
 	}
+	return matches.size() > 0;
+}
+
+// The cache key: the fragment, then the match mode, minimum length and
+// library version.
+void GenomeMatcherImpl::cacheKey(const Library& library, const string& fragment, int minimumLength,
+	bool exactMatchOnly, string& key) const
+{
+	key.assign(fragment);
+	key.push_back(exactMatchOnly ? '=' : '~');
+	key.append((const char*)&minimumLength, sizeof(minimumLength));
+	key.append((const char*)&library.version, sizeof(library.version));
 }
 
+// Fragments are handed out in chunks from a shared counter, so a thread that
+// finishes its chunk early just takes the next one.  Each thread tallies its
+// hits in its own per-genome counts, which are summed at the end, so the
+// counts and the results are the same for any number of threads.  With the
+// query cache on, fragments found in it are counted from there, and only
+// the rest are searched.  Hits the prefilter has thinned out aren't cached.
 bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, 
-	bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+	bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, int threads, bool prefilter,
+	QueryStats* stats) const
 {
+	if (stats != nullptr)
+		*stats = QueryStats();
 	if (matchPercentThreshold < 0 || matchPercentThreshold > 100)
 		return false;
+	shared_ptr<const Library> current = library();
+	if (fragmentMatchLength < current->searchMin || fragmentMatchLength <= 0)
+		return false;
+	const int FRAGMENTS_PER_CHUNK = 64;
 	int num = query.length() / fragmentMatchLength;
-	string curFrag;
-	vector<DNAMatch> matches;
-	int nMatches;
-	map<string, int> genomeToMatchCount;
-	for (int i = 0; i != num; i++)
-	{
-		query.extract(i*fragmentMatchLength, fragmentMatchLength, curFrag);
-		findGenomesWithThisDNA(curFrag, fragmentMatchLength, exactMatchOnly, matches);
-		nMatches = matches.size();
-		for (int j = 0; j != nMatches; j++)  //for every genome that returns a match to this fragment 
+	vector<char> candidates;
+	PhaseTimer prefilterTimer(stats);
+	if (prefilter && current->relatedCandidates(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, candidates) == 0)
+		return false;                    //no genome can be related
+	if (!prefilter && current->removed != 0)
+		candidates = current->live;
+	prefilterTimer.lap(&QueryStats::candidateSeconds);
+	if (threads <= 0)
+		threads = thread::hardware_concurrency();
+	threads = max(1, min(threads, (num + FRAGMENTS_PER_CHUNK - 1) / FRAGMENTS_PER_CHUNK));
+	vector<vector<int> > threadCounts(threads, vector<int>(current->genomeCount(), 0));  //indexed by genome ID
+	vector<QueryStats> threadStats(stats != nullptr ? threads : 0);
+	const bool caching = m_queryCache.capacity() != 0;
+	atomic<int> nextFragment(0);
+	auto countMatches = [&](int t) {
+		QueryBuffers buffers;
+		vector<string>& chunk = buffers.chunk;     //the fragments that aren't cached
+		vector<string>& keys = buffers.chunkKeys;
+		vector<Hit>& hits = buffers.hits;
+		vector<int>& offsets = buffers.chunkOffsets;
+		if (!candidates.empty())
+			buffers.genomeFilter = &candidates;
+		if (stats != nullptr)
+			buffers.stats = &threadStats[t];
+		vector<int>& matchCounts = threadCounts[t];
+		auto countCached = [&candidates, &matchCounts](const vector<Hit>& cached) {
+			for (const Hit& h : cached)
+			{
+				if (candidates.empty() || candidates[h.genomeId])
+					matchCounts[h.genomeId]++;
+			}
+		};
+		for (;;)
 		{
-			string curGenName = matches[j].genomeName;
-			if (genomeToMatchCount.find(curGenName) == genomeToMatchCount.end()) {  //if its not in the map
-				genomeToMatchCount[curGenName] = 1;                                 //add it and say there's 1 match
+			int first = nextFragment.fetch_add(FRAGMENTS_PER_CHUNK);
+			if (first >= num)
+				break;
+			PhaseTimer timer(buffers.stats);
+			const int searched = min(num, first + FRAGMENTS_PER_CHUNK) - first;
+			chunk.resize(max(chunk.size(), (size_t)searched));
+			keys.resize(max(keys.size(), (size_t)searched));
+			int uncached = 0;
+			for (int i = first; i != first + searched; i++)
+			{
+				string& fragment = chunk[uncached];    //a cached one is written over by the next
+				string& key = keys[uncached];
+				const size_t fragmentCapacity = fragment.capacity();
+				const size_t keyCapacity = key.capacity();
+				query.extract(i*fragmentMatchLength, fragmentMatchLength, fragment);
+				if (caching)
+					cacheKey(*current, fragment, fragmentMatchLength, exactMatchOnly, key);
+				buffers.grownStrings += (fragment.capacity() != fragmentCapacity) + (key.capacity() != keyCapacity);
+				if (caching && m_queryCache.find(key, countCached))
+					continue;
+				uncached++;
+			}
+			timer.lap(&QueryStats::lookupSeconds);
+			if (buffers.stats != nullptr)
+			{
+				buffers.stats->queries += searched;
+				buffers.stats->cacheHits += searched - uncached;
+			}
+			if (chunk.size() != (size_t)uncached)    //only in the last chunk, or with cached fragments
+				chunk.resize(uncached);
+			hits.clear();
+			current->findHitsBatch(chunk, fragmentMatchLength, exactMatchOnly, hits, offsets, buffers);    //a chunk's lookups share the trie walk
+			timer = PhaseTimer(buffers.stats);     //findHitsBatch timed its own phases
+			for (const Hit& h : hits)  //for every genome that returns a match to a fragment
+				matchCounts[h.genomeId]++;
+			timer.lap(&QueryStats::groupSeconds);
+			if (!caching || prefilter)
+				continue;
+			for (size_t q = 0; q != chunk.size(); q++)
+			{
+				size_t allocated = m_queryCache.insert(keys[q], vector<Hit>(hits.begin() + offsets[q], hits.begin() + offsets[q + 1]));
+				if (buffers.stats != nullptr)
+					buffers.stats->allocations += allocated + (offsets[q + 1] != offsets[q]);
 			}
-			else
-				genomeToMatchCount[curGenName]++;
 		}
+		if (buffers.stats != nullptr)
+			buffers.stats->allocations += buffers.grown();
+	};
+	vector<thread> workers;
+	for (int t = 1; t < threads; t++)
+		workers.push_back(thread(countMatches, t));
+	countMatches(0);                    //this thread works too
+	for (thread& w : workers)
+		w.join();
+	for (const QueryStats& s : threadStats)
+		addStats(*stats, s);
+	vector<int>& matchCounts = threadCounts[0];
+	for (int t = 1; t < threads; t++)
+	{
+		for (size_t id = 0; id != matchCounts.size(); id++)
+			matchCounts[id] += threadCounts[t][id];
 	}
+
 	GenomeMatch g;
-	map<string, int>::iterator it = genomeToMatchCount.begin();
-	for (; it != genomeToMatchCount.end(); it++)
+	for (size_t id = 0; id != matchCounts.size(); id++)
 	{
-		g.genomeName = (*it).first;
-		g.percentMatch = 100* (*it).second / num;
+		if (matchCounts[id] == 0)
+			continue;
+		g.percentMatch = 100.0 * matchCounts[id] / num;
 		if (g.percentMatch >= matchPercentThreshold)
+		{
+			g.genomeName = current->genome(id).name();
 			results.push_back(g);
+		}
 	}
 	sort(results.begin(), results.end(), compareGenomeMatch);
 	return results.size() > 0;
 }
 
+void GenomeMatcherImpl::setQueryCacheSize(size_t fragments)
+{
+	m_queryCache.setCapacity(fragments);
+}
+
+QueryCacheStats GenomeMatcherImpl::queryCacheStats() const
+{
+	QueryCacheStats stats;
+	stats.hits = m_queryCache.hits();
+	stats.misses = m_queryCache.misses();
+	stats.entries = m_queryCache.size();
+	stats.capacity = m_queryCache.capacity();
+	return stats;
+}
+
+void Segment::countShared(const Sketch& query, vector<int>& shared) const
+{
+	vector<int> counts;
+	m_sketchIndex.count(query, counts);
+	copy(counts.begin(), counts.end(), shared.begin() + m_firstId);
+}
+
+void Segment::countMemory(MemoryTally parts[MEMORY_PARTS]) const
+{
+	const size_t SHORT_STRING = 15;       //kept inside the string object, at least by libstdc++
+	parts[NAMES].add(m_genomes);
+	for (const Genome& g : m_genomes)
+	{
+		g.sequence().countMemory(parts[SEQUENCES]);
+		  //each genome's shared record holds its name, sequence and reference count
+		parts[NAMES].add(sizeof(string) + sizeof(PackedSequence) + sizeof(atomic<int>));
+		size_t nameLength = g.name().size();
+		if (nameLength > SHORT_STRING)
+			parts[NAMES].add(nameLength + 1);
+	}
+	if (m_indexType == GenomeMatcher::FM_INDEX)
+		m_fmIndex.countMemory(parts[INDEX_NODES], parts[POSTINGS]);
+	else if (hashedIndex())
+		m_kmerIndex.countMemory(parts[INDEX_NODES], parts[POSTINGS]);
+	else
+		m_genomeData.countMemory(parts[INDEX_NODES], parts[POSTINGS]);
+	parts[SKETCHES].add(m_sketches);
+	for (const Sketch& s : m_sketches)
+		s.countMemory(parts[SKETCHES]);
+	m_sketchIndex.countMemory(parts[SKETCHES]);
+}
+
+// Genomes in more than one segment are counted for each, but a segment
+// only holds genomes another holds while it is being merged.
+void GenomeMatcherImpl::countMemory(const Library& library, MemoryTally parts[MEMORY_PARTS]) const
+{
+	for (const shared_ptr<const Segment>& s : library.segments)
+		s->countMemory(parts);
+	parts[NAMES].add(library.live);
+	m_queryCache.countMemory(parts[QUERY_CACHE], [](const vector<Hit>& hits, MemoryTally& tally) {
+		tally.add(hits);
+	});
+}
+
+MemoryUsage GenomeMatcherImpl::memoryUsage() const
+{
+	MemoryTally parts[MEMORY_PARTS];
+	countMemory(*library(), parts);
+	MemoryUsage usage;
+	size_t* bytes[MEMORY_PARTS] = { &usage.sequences, &usage.names, &usage.indexNodes, &usage.postings,
+		&usage.sketches, &usage.queryCache };
+	for (int p = 0; p != MEMORY_PARTS; p++)
+	{
+		*bytes[p] = parts[p].bytes;
+		usage.allocatorOverhead += parts[p].overhead;
+		usage.total += parts[p].bytes + parts[p].overhead;
+		usage.mapped += parts[p].mapped;
+	}
+	return usage;
+}
+
+// Every part but the query cache grows by its current bytes per base.  The
+// genomes already in the library keep their sequences, names and sketches
+// where they are, mapped or not; the index is added to, which copies a
+// mapped one, or rebuilt, so all of it ends up allocated.
+MemoryUsage GenomeMatcherImpl::projectedMemoryUsage(size_t moreBases) const
+{
+	shared_ptr<const Library> current = library();
+	MemoryTally parts[MEMORY_PARTS];
+	countMemory(*current, parts);
+	double bases = current->bases();
+	if (bases == 0)                      //nothing to go by
+		return memoryUsage();
+	const double growth = moreBases / bases;
+	MemoryUsage usage;
+	size_t* bytes[MEMORY_PARTS] = { &usage.sequences, &usage.names, &usage.indexNodes, &usage.postings,
+		&usage.sketches, &usage.queryCache };
+	for (int p = 0; p != MEMORY_PARTS; p++)
+	{
+		const MemoryTally& part = parts[p];
+		double projected = part.bytes;
+		if (p == INDEX_NODES || p == POSTINGS)
+			projected = (part.bytes + part.mapped) * (1 + growth);
+		else if (p != QUERY_CACHE)
+		{
+			projected = part.bytes + (part.bytes + part.mapped) * growth;
+			usage.mapped += part.mapped;
+		}
+		*bytes[p] = (size_t)projected;
+		  //the overhead keeps the same share of each part
+		size_t overhead = part.bytes == 0 ? 0 : (size_t)(projected * part.overhead / part.bytes);
+		usage.allocatorOverhead += overhead;
+		usage.total += *bytes[p] + overhead;
+	}
+	return usage;
+}
+
 bool compareGenomeMatch(const GenomeMatch & lhs, const GenomeMatch & rhs)
 {
 	if (lhs.percentMatch > rhs.percentMatch)
@@ -199,9 +1546,9 @@ bool compareGenomeMatch(const GenomeMatch & lhs, const GenomeMatch & rhs)
 // These functions simply delegate to GenomeMatcherImpl's functions.
 // You probably don't want to change any of this code.
 
-GenomeMatcher::GenomeMatcher(int minSearchLength)
+GenomeMatcher::GenomeMatcher(int minSearchLength, IndexType indexType)
 {
-    m_impl = new GenomeMatcherImpl(minSearchLength);
+    m_impl = new GenomeMatcherImpl(minSearchLength, indexType);
 }
 
 GenomeMatcher::~GenomeMatcher()
@@ -209,9 +1556,44 @@ GenomeMatcher::~GenomeMatcher()
     delete m_impl;
 }
 
-void GenomeMatcher::addGenome(const Genome& genome)
+bool GenomeMatcher::addGenome(const Genome& genome)
+{
+    return m_impl->addGenome(Genome(genome));     // copying a genome only shares it
+}
+
+bool GenomeMatcher::addGenome(Genome&& genome)
+{
+    return m_impl->addGenome(move(genome));
+}
+
+bool GenomeMatcher::addGenomes(const vector<Genome>& genomes, int threads)
+{
+    return m_impl->addGenomes(genomes, threads);
+}
+
+bool GenomeMatcher::removeGenome(const string& name)
+{
+    return m_impl->removeGenome(name);
+}
+
+bool GenomeMatcher::replaceGenome(const Genome& genome)
+{
+    return m_impl->replaceGenome(genome);
+}
+
+void GenomeMatcher::compact()
+{
+    m_impl->compact();
+}
+
+bool GenomeMatcher::save(const string& indexPath) const
+{
+    return m_impl->save(indexPath);
+}
+
+bool GenomeMatcher::open(const string& indexPath, bool verifyChecksum)
 {
-    m_impl->addGenome(genome);
+    return m_impl->open(indexPath, verifyChecksum);
 }
 
 int GenomeMatcher::minimumSearchLength() const
@@ -219,12 +1601,37 @@ int GenomeMatcher::minimumSearchLength() const
     return m_impl->minimumSearchLength();
 }
 
-bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches, QueryStats* stats) const
+{
+    return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches, stats);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNA(const vector<string>& fragments, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches, vector<int>& offsets) const
+{
+    return m_impl->findGenomesWithThisDNA(fragments, minimumLength, exactMatchOnly, matches, offsets);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, int threads, bool prefilter, QueryStats* stats) const
+{
+    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results, threads, prefilter, stats);
+}
+
+void GenomeMatcher::setQueryCacheSize(size_t fragments)
+{
+    m_impl->setQueryCacheSize(fragments);
+}
+
+QueryCacheStats GenomeMatcher::queryCacheStats() const
+{
+    return m_impl->queryCacheStats();
+}
+
+MemoryUsage GenomeMatcher::memoryUsage() const
 {
-    return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches);
+    return m_impl->memoryUsage();
 }
 
-bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+MemoryUsage GenomeMatcher::projectedMemoryUsage(size_t moreBases) const
 {
-    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+    return m_impl->projectedMemoryUsage(moreBases);
 }
@@ -0,0 +1,469 @@
+#ifndef INDEXFILE_INCLUDED
+#define INDEXFILE_INCLUDED
+
+#include "Storage.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <type_traits>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Index files hold a saved GenomeMatcher in a form that can be memory-mapped
+// and searched in place.  The file is a header, the library's arrays, each
+// starting on a 64-byte boundary, and a directory with one entry per saved
+// array or number, in the order they were saved.
+//
+// A class that can be saved has a save(Writer&) that writes its parts with
+// value() and array(), and a load(Reader&) that reads them back in the same
+// order into its numbers and Storage arrays.  Loading views each array in
+// the mapped file instead of copying it (see Storage.h), so it takes time
+// in proportion to the number of arrays, not their size, and the file must
+// stay mapped while anything views it.  load returns false if an entry is
+// missing or of the wrong kind, or if the parts don't fit together, such as
+// arrays of mismatched sizes; it never checks the contents beyond that.
+//
+// Numbers and arrays are stored in the byte order and layout of the machine
+// that wrote the file; a file from a machine that differs is rejected.
+
+const uint32_t INDEX_VERSION = 3;         // bump whenever anything saves something different
+const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+struct IndexHeader
+{
+	char magic[8];                        // "GMINDEX"
+	uint32_t version;
+	uint32_t byteOrder;                   // INDEX_BYTE_ORDER as the writer stored it
+	uint64_t fileSize;
+	uint64_t directoryOffset;
+	uint64_t directoryCount;
+	uint64_t dataChecksum;                // the saved arrays, in directory order
+	uint64_t headerChecksum;              // this header, with this field zero, and the directory
+	uint64_t reserved;
+};
+
+struct IndexEntry
+{
+	uint64_t offset;                      // where the array starts, or the number itself
+	uint64_t count;                       // elements in the array
+	uint64_t elementSize;                 // 0 for a number
+};
+
+// Checksum of the bytes, continuing from seed.  Bytes past the last whole
+// 8-byte word are padded with zeros, as they are in the file.
+inline uint64_t indexChecksum(uint64_t seed, const void* data, size_t bytes)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint64_t h = seed;
+	while (bytes != 0)
+	{
+		uint64_t word = 0;
+		size_t n = bytes < 8 ? bytes : 8;
+		std::memcpy(&word, p, n);
+		h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+		p += n;
+		bytes -= n;
+	}
+	return h;
+}
+
+// A read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const std::string& path);
+	void close();
+	const unsigned char* data() const;
+	size_t size() const;
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+private:
+	const unsigned char* m_data;
+	size_t m_size;
+#if defined(_WIN32)
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+};
+
+// Writes an index file.  Nothing is usable until finish() succeeds.  The
+// file is written beside path, under a name no other writer has, and only
+// renamed over it once complete, so a library mapped onto the old file
+// keeps its view of it, a failed write leaves the old file as it was, and
+// processes saving to one path at once each put a whole file there.
+class IndexWriter
+{
+public:
+	IndexWriter();
+	~IndexWriter();                       // removes the unfinished file, if any
+	bool open(const std::string& path);
+	template<typename T>
+	void value(T number);
+	template<typename T>
+	void array(const T* data, size_t count);
+	bool finish();
+private:
+	static const uint64_t ALIGNMENT = 64;
+
+	std::ofstream m_out;
+	std::string m_path;
+	std::string m_tempPath;
+	uint64_t m_offset;
+	uint64_t m_checksum;
+	std::vector<IndexEntry> m_directory;
+
+	void pad();
+	static bool createTempFile(const std::string& path, std::string& tempPath);
+};
+
+// Reads the entries of a mapped index file back in the order they were
+// written.  Each read fails, and so does every read after it, if the next
+// entry is not what the caller expects.
+class IndexReader
+{
+public:
+	explicit IndexReader(const MappedFile& file);
+	  // Checks the header and directory against their checksum, and that
+	  // every array lies inside the file, without reading the arrays.  With
+	  // verifyData it also checks the arrays' checksum, which reads the
+	  // whole file; the loaders trust what they view, so only that catches
+	  // arrays changed after the file was written.
+	bool start(bool verifyData);
+	template<typename T>
+	bool value(T& number);
+	template<typename T>
+	bool array(Storage<T>& out);
+	bool atEnd() const;
+private:
+	const MappedFile& m_file;
+	IndexHeader m_header;
+	const IndexEntry* m_directory;
+	size_t m_next;
+	bool m_failed;
+
+	const IndexEntry* next(uint64_t elementSize);
+};
+
+inline MappedFile::MappedFile()
+	:m_data(nullptr), m_size(0)
+#if defined(_WIN32)
+	, m_file(INVALID_HANDLE_VALUE), m_mapping(NULL)
+#endif
+{}
+
+inline MappedFile::~MappedFile()
+{
+	close();
+}
+
+inline bool MappedFile::open(const std::string& path)
+{
+	close();
+#if defined(_WIN32)
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL)
+	{
+		close();
+		return false;
+	}
+	void* view = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL)
+	{
+		close();
+		return false;
+	}
+	m_data = static_cast<const unsigned char*>(view);
+	m_size = (size_t)size.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);                          //the mapping keeps the file open
+	if (view == MAP_FAILED)
+		return false;
+	m_data = static_cast<const unsigned char*>(view);
+	m_size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+inline void MappedFile::close()
+{
+#if defined(_WIN32)
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != NULL)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+	m_mapping = NULL;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (m_data != nullptr)
+		munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+inline const unsigned char* MappedFile::data() const
+{
+	return m_data;
+}
+
+inline size_t MappedFile::size() const
+{
+	return m_size;
+}
+
+inline IndexWriter::IndexWriter()
+	:m_offset(0), m_checksum(0)
+{}
+
+inline IndexWriter::~IndexWriter()
+{
+	if (m_out.is_open())
+	{
+		m_out.close();
+		std::remove(m_tempPath.c_str());
+	}
+}
+
+inline bool IndexWriter::open(const std::string& path)
+{
+	m_path = path;
+	if (!createTempFile(path, m_tempPath))
+		return false;
+	m_out.open(m_tempPath.c_str(), std::ios::binary | std::ios::trunc);
+	if (!m_out.is_open())
+	{
+		std::remove(m_tempPath.c_str());
+		return false;
+	}
+	IndexHeader placeholder;              //rewritten by finish
+	std::memset(&placeholder, 0, sizeof(placeholder));
+	m_out.write(reinterpret_cast<const char*>(&placeholder), sizeof(placeholder));
+	m_offset = sizeof(placeholder);
+	m_checksum = 0;
+	m_directory.clear();
+	return m_out.good();
+}
+
+template<typename T>
+void IndexWriter::value(T number)
+{
+	IndexEntry e;
+	e.offset = (uint64_t)(int64_t)number;
+	e.count = 0;
+	e.elementSize = 0;
+	m_directory.push_back(e);
+}
+
+template<typename T>
+void IndexWriter::array(const T* data, size_t count)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "only plain data can be saved");
+	pad();
+	IndexEntry e;
+	e.offset = m_offset;
+	e.count = count;
+	e.elementSize = sizeof(T);
+	m_directory.push_back(e);
+	size_t bytes = count * sizeof(T);
+	if (bytes != 0)
+		m_out.write(reinterpret_cast<const char*>(data), bytes);
+	m_offset += bytes;
+	m_checksum = indexChecksum(m_checksum, data, bytes);
+}
+
+// Creates an empty file with a new name in path's directory.  It gets the
+// permissions of the file at path, if there is one, so renaming it there
+// doesn't change who can open the index.
+inline bool IndexWriter::createTempFile(const std::string& path, std::string& tempPath)
+{
+#if defined(_WIN32)
+	std::string::size_type slash = path.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+	char name[MAX_PATH];
+	if (GetTempFileNameA(directory.c_str(), "gmi", 0, name) == 0)
+		return false;
+	tempPath = name;
+	return true;
+#else
+	std::vector<char> name(path.begin(), path.end());
+	const char suffix[] = ".XXXXXX";
+	name.insert(name.end(), suffix, suffix + sizeof(suffix));
+	int fd = mkstemp(&name[0]);
+	if (fd < 0)
+		return false;
+	struct stat target;
+	mode_t mode = stat(path.c_str(), &target) == 0 ? (target.st_mode & 0777) : 0644;
+	fchmod(fd, mode);
+	::close(fd);
+	tempPath = &name[0];
+	return true;
+#endif
+}
+
+inline void IndexWriter::pad()
+{
+	static const char zeros[ALIGNMENT] = {};
+	uint64_t n = (ALIGNMENT - m_offset % ALIGNMENT) % ALIGNMENT;
+	m_out.write(zeros, n);
+	m_offset += n;
+}
+
+inline bool IndexWriter::finish()
+{
+	pad();
+	IndexHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, "GMINDEX", 8);
+	h.version = INDEX_VERSION;
+	h.byteOrder = INDEX_BYTE_ORDER;
+	h.directoryOffset = m_offset;
+	h.directoryCount = m_directory.size();
+	h.fileSize = m_offset + m_directory.size() * sizeof(IndexEntry);
+	h.dataChecksum = m_checksum;
+	if (!m_directory.empty())
+		m_out.write(reinterpret_cast<const char*>(&m_directory[0]), m_directory.size() * sizeof(IndexEntry));
+	h.headerChecksum = indexChecksum(indexChecksum(0, &h, sizeof(h)), m_directory.data(),
+		m_directory.size() * sizeof(IndexEntry));
+	m_out.seekp(0);
+	m_out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	m_out.close();
+	bool written = !m_out.fail();
+#if defined(_WIN32)
+	written = written && MoveFileExA(m_tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	written = written && std::rename(m_tempPath.c_str(), m_path.c_str()) == 0;
+#endif
+	if (!written)
+		std::remove(m_tempPath.c_str());
+	return written;
+}
+
+inline IndexReader::IndexReader(const MappedFile& file)
+	:m_file(file), m_directory(nullptr), m_next(0), m_failed(true)
+{}
+
+inline bool IndexReader::start(bool verifyData)
+{
+	m_failed = true;
+	if (m_file.size() < sizeof(IndexHeader))
+		return false;
+	std::memcpy(&m_header, m_file.data(), sizeof(IndexHeader));
+	if (std::memcmp(m_header.magic, "GMINDEX", 8) != 0 || m_header.version != INDEX_VERSION
+		|| m_header.byteOrder != INDEX_BYTE_ORDER || m_header.fileSize != m_file.size()
+		|| m_header.directoryOffset % sizeof(uint64_t) != 0 || m_header.directoryOffset > m_file.size()
+		|| m_header.directoryCount > (m_file.size() - m_header.directoryOffset) / sizeof(IndexEntry))
+		return false;
+	m_directory = reinterpret_cast<const IndexEntry*>(m_file.data() + m_header.directoryOffset);
+	IndexHeader unsummed = m_header;
+	unsummed.headerChecksum = 0;
+	if (indexChecksum(indexChecksum(0, &unsummed, sizeof(unsummed)), m_directory,
+		m_header.directoryCount * sizeof(IndexEntry)) != m_header.headerChecksum)
+		return false;
+	for (size_t i = 0; i != m_header.directoryCount; i++)     //every array must lie before the directory
+	{
+		const IndexEntry& e = m_directory[i];
+		if (e.elementSize != 0 && (e.offset > m_header.directoryOffset
+			|| e.count > (m_header.directoryOffset - e.offset) / e.elementSize))
+			return false;
+	}
+	if (verifyData)
+	{
+		uint64_t sum = 0;
+		for (size_t i = 0; i != m_header.directoryCount; i++)
+		{
+			const IndexEntry& e = m_directory[i];
+			if (e.elementSize != 0)
+				sum = indexChecksum(sum, m_file.data() + e.offset, e.count * e.elementSize);
+		}
+		if (sum != m_header.dataChecksum)
+			return false;
+	}
+	m_next = 0;
+	m_failed = false;
+	return true;
+}
+
+inline const IndexEntry* IndexReader::next(uint64_t elementSize)
+{
+	if (m_failed || m_next == m_header.directoryCount || m_directory[m_next].elementSize != elementSize)
+	{
+		m_failed = true;
+		return nullptr;
+	}
+	return &m_directory[m_next++];
+}
+
+template<typename T>
+bool IndexReader::value(T& number)
+{
+	const IndexEntry* e = next(0);
+	if (e == nullptr)
+		return false;
+	number = (T)(int64_t)e->offset;
+	if ((uint64_t)(int64_t)number != e->offset)     //doesn't fit
+		m_failed = true;
+	return !m_failed;
+}
+
+template<typename T>
+bool IndexReader::array(Storage<T>& out)
+{
+	const IndexEntry* e = next(sizeof(T));
+	if (e == nullptr)
+		return false;
+	if (e->offset % alignof(T) != 0)
+	{
+		m_failed = true;
+		return false;
+	}
+	out.view(reinterpret_cast<const T*>(m_file.data() + e->offset), (size_t)e->count);
+	return true;
+}
+
+inline bool IndexReader::atEnd() const
+{
+	return !m_failed && m_next == m_header.directoryCount;
+}
+
+#endif // INDEXFILE_INCLUDED
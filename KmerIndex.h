@@ -0,0 +1,406 @@
+#ifndef KMERINDEX_INCLUDED
+#define KMERINDEX_INCLUDED
+
+#include "PackedSequence.h"
+#include "Trie.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+
+// A hash index of every k-mer of a set of DNA sequences, for k up to 32.
+// Each k-mer without an N is a 2k-bit code, rolled along the sequences one
+// base at a time; the distinct codes are sorted, their occurrences are
+// stored back to back in the same order, and an open-addressing table maps
+// a code to its place, so an exact lookup is one hash probe.  The few
+// k-mers with an N go into a small trie instead.
+//
+// With a window of w > 1 the index is sampled: of every w consecutive
+// k-mers it keeps only the minimizer, the one whose code hashes lowest
+// (the leftmost on ties), and lookups are of keys of w + k - 1 bases.  Equal
+// keys have equal minimizers, so every place a key occurs is still found,
+// from the key's own minimizer, while the index keeps about 2 / (w + 1) of
+// the k-mers.  Keys whose every k-mer has an N go into the trie whole.
+class KmerIndex
+{
+public:
+	static constexpr int MAX_KEY_LENGTH = 32;
+
+	KmerIndex();
+	void build(const std::vector<const PackedSequence*>& sequences, int keyLength, int window = 1);
+	int span() const;                     // bases in a lookup key
+	  // Whether an index fits that stores occurrenceCount k-mer occurrences,
+	  // counted in 32 bits, and nKeyCount keys of span bases with an N in
+	  // its trie.
+	static bool fits(size_t occurrenceCount, size_t nKeyCount, int span);
+	size_t occurrenceCount() const;       // the trie's aside
+	  // Adds the memory of the codes and their hash table to table, and of
+	  // the occurrences to occurrences.
+	void countMemory(MemoryTally& table, MemoryTally& occurrences) const;
+	  // Spreads a k-mer code over 64 bits.  It's a bijection, so distinct
+	  // codes never collide; Sketch uses it too.
+	static uint64_t hash(uint64_t code);
+
+	  // Calls report(sequence, position) for every occurrence of the span()
+	  // bases at key.  When exactMatchOnly is false it also reports the
+	  // places where key's first base matches and exactly one other base
+	  // differs, like Trie::find.  A sampled index also reports places that
+	  // only share a minimizer with the key (or with one of its variants),
+	  // so callers must verify what it reports, and may see a place twice.
+	template<typename Report>
+	void findSeeds(const char* key, bool exactMatchOnly, Report report) const;
+
+	  // Saves the codes, their table and occurrences, and the trie of keys
+	  // with an N; loading checks that the table and offsets match the codes.
+	template<typename Writer>
+	void save(Writer& out) const;
+	template<typename Reader>
+	bool load(Reader& in);
+private:
+	static constexpr uint32_t EMPTY = ~0u;   // unused table slot
+
+	struct Occurrence
+	{
+		uint32_t sequence;
+		uint32_t position;
+	};
+
+	struct Entry                          // one k-mer occurrence while building
+	{
+		uint64_t code;
+		Occurrence occurrence;
+	};
+
+	int m_keyLength;
+	int m_window;                         // k-mers sampled from; 1 keeps them all
+	Storage<uint64_t> m_codes;            // distinct codes, in increasing order
+	Storage<uint32_t> m_starts;           // where each code's occurrences start; one extra at the end
+	Storage<Occurrence> m_occurrences;
+	Storage<uint32_t> m_table;            // code indexes, by hash; a power of two at most half full
+	Trie<Occurrence> m_nKmers;            // keys with an N in every k-mer, which have no code
+
+	uint32_t lookup(uint64_t code) const;
+	template<typename Report>
+	void reportCode(uint64_t code, Report& report, uint32_t offset = 0) const;
+	bool minimizer(const char* key, int changed, char base, uint64_t& code, int& offset) const;
+	template<typename Report>
+	void findSampled(const char* key, bool exactMatchOnly, Report& report) const;
+	static void radixSort(std::vector<Entry>& entries, int bits);
+};
+
+inline KmerIndex::KmerIndex()
+	:m_keyLength(0), m_window(1)
+{}
+
+inline int KmerIndex::span() const
+{
+	return m_keyLength + m_window - 1;
+}
+
+inline bool KmerIndex::fits(size_t occurrenceCount, size_t nKeyCount, int span)
+{
+	return occurrenceCount < EMPTY && Trie<Occurrence>::fits(nKeyCount, span);
+}
+
+inline size_t KmerIndex::occurrenceCount() const
+{
+	return m_occurrences.size();
+}
+
+inline void KmerIndex::countMemory(MemoryTally& table, MemoryTally& occurrences) const
+{
+	table.add(m_codes);
+	table.add(m_starts);
+	table.add(m_table);
+	occurrences.add(m_occurrences);
+	m_nKmers.countMemory(table, occurrences);
+}
+
+inline uint64_t KmerIndex::hash(uint64_t code)
+{
+	code ^= code >> 29;
+	code *= 0x9E3779B97F4A7C15ULL;
+	return code ^ (code >> 32);
+}
+
+inline void KmerIndex::build(const std::vector<const PackedSequence*>& sequences, int keyLength, int window)
+{
+	struct Candidate                      // a k-mer that may yet be a window's minimizer
+	{
+		uint64_t hash;
+		uint64_t code;
+		int position;
+	};
+	m_keyLength = keyLength;
+	m_window = window;
+	m_nKmers.reset();
+	const int keySpan = span();
+	const uint64_t mask = keyLength == MAX_KEY_LENGTH ? ~0ULL : (1ULL << (2 * keyLength)) - 1;
+	std::vector<Entry> entries;
+	size_t total = 0;
+	for (const PackedSequence* s : sequences)
+		total += std::max(0, s->length() - keyLength + 1);
+	entries.reserve(window == 1 ? total : 2 * total / (window + 1));
+	std::string bases;
+	std::string key;
+	std::deque<Candidate> candidates;     //increasing hashes, so the front is the minimizer
+	for (size_t seq = 0; seq != sequences.size(); seq++)
+	{
+		const int length = sequences[seq]->length();
+		sequences[seq]->unpack(0, length, bases);
+		candidates.clear();
+		uint64_t code = 0;
+		int lastN = -1;                   //the k-mers that include it have no code
+		int lastMinimizer = -1;
+		for (int i = 0; i != length; i++)
+		{
+			int c = PackedSequence::code(bases[i]);
+			if (c < 0 || bases[i] == 'N')
+			{
+				lastN = i;
+				c = 0;
+			}
+			code = ((code << 2) | c) & mask;
+			int start = i - keyLength + 1;
+			if (start < 0)
+				continue;
+			if (lastN < start)
+			{
+				uint64_t h = hash(code);
+				while (!candidates.empty() && candidates.back().hash > h)
+					candidates.pop_back();
+				candidates.push_back(Candidate{ h, code, start });
+			}
+			int windowStart = start - window + 1;
+			if (windowStart < 0)
+				continue;
+			while (!candidates.empty() && candidates.front().position < windowStart)
+				candidates.pop_front();
+			if (candidates.empty())       //an N in every k-mer
+			{
+				key.assign(bases, windowStart, keySpan);
+				m_nKmers.insert(key, Occurrence{ (uint32_t)seq, (uint32_t)windowStart });
+				continue;
+			}
+			const Candidate& m = candidates.front();
+			if (m.position != lastMinimizer)      //neighboring windows mostly share it
+			{
+				entries.push_back(Entry{ m.code, Occurrence{ (uint32_t)seq, (uint32_t)m.position } });
+				lastMinimizer = m.position;
+			}
+		}
+	}
+	radixSort(entries, 2 * keyLength);    //stable, so each code's occurrences stay in text order
+
+	std::vector<uint64_t> codes;
+	std::vector<uint32_t> starts;
+	std::vector<Occurrence> occurrences(entries.size());
+	for (size_t i = 0; i != entries.size(); i++)
+	{
+		if (i == 0 || entries[i].code != entries[i - 1].code)
+		{
+			codes.push_back(entries[i].code);
+			starts.push_back((uint32_t)i);
+		}
+		occurrences[i] = entries[i].occurrence;
+	}
+	starts.push_back((uint32_t)entries.size());
+	std::vector<Entry>().swap(entries);
+
+	size_t tableSize = 16;
+	while (tableSize < 2 * codes.size())
+		tableSize *= 2;
+	std::vector<uint32_t> table(tableSize, EMPTY);
+	for (size_t i = 0; i != codes.size(); i++)
+	{
+		size_t slot = hash(codes[i]) & (tableSize - 1);
+		while (table[slot] != EMPTY)
+			slot = (slot + 1) & (tableSize - 1);
+		table[slot] = (uint32_t)i;
+	}
+	m_codes.clear();
+	m_codes.swap(codes);
+	m_starts.clear();
+	m_starts.swap(starts);
+	m_occurrences.clear();
+	m_occurrences.swap(occurrences);
+	m_table.clear();
+	m_table.swap(table);
+}
+
+// Least significant digit first, eight bits a pass, over the low bits of
+// each code.
+inline void KmerIndex::radixSort(std::vector<Entry>& entries, int bits)
+{
+	std::vector<Entry> sorted(entries.size());
+	for (int shift = 0; shift < bits; shift += 8)
+	{
+		size_t counts[257] = {};
+		for (const Entry& e : entries)
+			counts[((e.code >> shift) & 0xFF) + 1]++;
+		for (int d = 0; d != 256; d++)
+			counts[d + 1] += counts[d];
+		for (const Entry& e : entries)
+			sorted[counts[(e.code >> shift) & 0xFF]++] = e;
+		entries.swap(sorted);
+	}
+}
+
+inline uint32_t KmerIndex::lookup(uint64_t code) const
+{
+	const size_t slots = m_table.size();
+	if (slots == 0)
+		return EMPTY;
+	for (size_t slot = hash(code) & (slots - 1); ; slot = (slot + 1) & (slots - 1))
+	{
+		uint32_t i = m_table[slot];
+		if (i == EMPTY || m_codes[i] == code)
+			return i;
+	}
+}
+
+template<typename Report>
+void KmerIndex::reportCode(uint64_t code, Report& report, uint32_t offset) const
+{
+	uint32_t i = lookup(code);
+	if (i == EMPTY)
+		return;
+	for (uint32_t j = m_starts[i]; j != m_starts[i + 1]; j++)
+	{
+		if (m_occurrences[j].position >= offset)      //offset bases into a key that would start here
+			report(m_occurrences[j].sequence, m_occurrences[j].position - offset);
+	}
+}
+
+// The minimizer of key with the base at changed replaced by base (changed
+// is -1 to leave key as it is): its code and where it starts in the key.
+// False if every k-mer of the key has an N.
+inline bool KmerIndex::minimizer(const char* key, int changed, char base, uint64_t& code, int& offset) const
+{
+	const int k = m_keyLength;
+	const uint64_t mask = k == MAX_KEY_LENGTH ? ~0ULL : (1ULL << (2 * k)) - 1;
+	uint64_t rolling = 0;
+	uint64_t best = 0;
+	int lastN = -1;
+	offset = -1;
+	for (int i = 0; i != span(); i++)
+	{
+		char b = i == changed ? base : key[i];
+		int c = PackedSequence::code(b);
+		if (c < 0 || b == 'N')
+		{
+			lastN = i;
+			c = 0;
+		}
+		rolling = ((rolling << 2) | c) & mask;
+		int start = i - k + 1;
+		if (start < 0 || lastN >= start)
+			continue;
+		uint64_t h = hash(rolling);
+		if (offset < 0 || h < best)       //the leftmost on ties, as in build
+		{
+			best = h;
+			code = rolling;
+			offset = start;
+		}
+	}
+	return offset >= 0;
+}
+
+template<typename Report>
+void KmerIndex::findSampled(const char* key, bool exactMatchOnly, Report& report) const
+{
+	uint64_t code;
+	int offset;
+	if (minimizer(key, -1, 0, code, offset))
+		reportCode(code, report, offset);
+	if (exactMatchOnly)
+		return;
+	  //a key one base off has a minimizer of its own, so look up every one
+	static const char alphabet[] = "ACGTN";
+	for (int d = 1; d != span(); d++)     //the first base must always match
+	{
+		for (int b = 0; b != 5; b++)
+		{
+			if (alphabet[b] != key[d] && minimizer(key, d, alphabet[b], code, offset))
+				reportCode(code, report, offset);
+		}
+	}
+}
+
+template<typename Report>
+void KmerIndex::findSeeds(const char* key, bool exactMatchOnly, Report report) const
+{
+	const int k = m_keyLength;
+	if (k == 0)
+		return;
+	m_nKmers.find(key, span(), exactMatchOnly, [&report](const Occurrence* values, uint32_t count) {
+		for (uint32_t i = 0; i != count; i++)
+			report(values[i].sequence, values[i].position);
+	});
+	if (m_window > 1)
+	{
+		findSampled(key, exactMatchOnly, report);
+		return;
+	}
+
+	  //the table only holds k-mers without an N, so an N in the key is a
+	  //mismatch against all of them
+	uint64_t code = 0;
+	int nAt = -1;
+	int nCount = 0;
+	for (int i = 0; i != k; i++)
+	{
+		int c = PackedSequence::code(key[i]);
+		if (c < 0 || key[i] == 'N')
+		{
+			nAt = i;
+			nCount++;
+			c = 0;
+		}
+		code = (code << 2) | (uint64_t)c;
+	}
+	if (nCount == 0)
+		reportCode(code, report);
+	if (exactMatchOnly || nCount > 1 || nAt == 0)
+		return;
+	for (int d = 1; d != k; d++)          //the first base must always match
+	{
+		if (nCount == 1 && d != nAt)      //the N is the one mismatch
+			continue;
+		const int shift = 2 * (k - 1 - d);
+		const uint64_t own = (code >> shift) & 3;
+		for (uint64_t c = 0; c != 4; c++)
+		{
+			if (c != own || nCount == 1)
+				reportCode((code & ~(3ULL << shift)) | (c << shift), report);
+		}
+	}
+}
+
+template<typename Writer>
+void KmerIndex::save(Writer& out) const
+{
+	out.value(m_keyLength);
+	out.value(m_window);
+	out.array(m_codes.data(), m_codes.size());
+	out.array(m_starts.data(), m_starts.size());
+	out.array(m_occurrences.data(), m_occurrences.size());
+	out.array(m_table.data(), m_table.size());
+	m_nKmers.save(out);
+}
+
+template<typename Reader>
+bool KmerIndex::load(Reader& in)
+{
+	if (!in.value(m_keyLength) || !in.value(m_window) || !in.array(m_codes) || !in.array(m_starts) || !in.array(m_occurrences)
+		|| !in.array(m_table) || !m_nKmers.load(in))
+		return false;
+	const size_t slots = m_table.size();
+	const Storage<uint32_t>& starts = m_starts;     //reading through a non-const view would copy it
+	return m_keyLength > 0 && m_keyLength <= MAX_KEY_LENGTH && m_window > 0 && starts.size() == m_codes.size() + 1
+		&& starts.back() == m_occurrences.size() && slots >= 2 * m_codes.size() && (slots & (slots - 1)) == 0;
+}
+
+#endif // KMERINDEX_INCLUDED
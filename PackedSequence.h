@@ -0,0 +1,505 @@
+#ifndef PACKEDSEQUENCE_INCLUDED
+#define PACKEDSEQUENCE_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include "Storage.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PACKEDSEQUENCE_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PACKEDSEQUENCE_SSE2 1
+#endif
+
+// A DNA sequence stored 2 bits per base (A=0, C=1, G=2, T=3), 32 bases per
+// 64-bit word with base i of a word in bits 2i and 2i+1.  N bases are stored
+// as A in the words and recorded in a separate run-length table, so a
+// sequence without Ns costs exactly a quarter byte per base.
+class PackedSequence
+{
+public:
+	static constexpr int BASES_PER_WORD = 32;
+	static constexpr uint64_t LOW_BITS = 0x5555555555555555ULL;  // bit 2i of every base
+
+	struct NRun
+	{
+		uint32_t start;
+		uint32_t length;
+	};
+
+	  // How matchLength compares bases: one at a time, one 64-bit word (32
+	  // bases) at a time, or several words per step with SSE2/AVX2 when the
+	  // compiler targets them (otherwise the same as WORD_KERNEL).
+	enum Kernel { SCALAR_KERNEL, WORD_KERNEL, SIMD_KERNEL };
+
+	PackedSequence();
+	explicit PackedSequence(const std::string& bases);
+
+	  // Adds count bases to the end; anything that isn't ACGT becomes an N.
+	void append(const char* bases, int count);
+	void reserve(int count);
+	void shrinkToFit();
+	void clear();                         // keeps the memory for reuse
+	void countMemory(MemoryTally& tally) const;
+	size_t allocations() const;           // blocks its arrays have allocated so far
+
+	int length() const;
+	char at(int pos) const;
+	void unpack(int pos, int len, std::string& out) const;
+
+	  // The 32 bases starting at pos in the packed layout; bases past the end
+	  // of the sequence read as zero.
+	uint64_t window(int pos) const;
+	  // Bit 2i is set when base pos+i is an N.
+	uint64_t nMask(int pos) const;
+	bool hasN(int pos, int len) const;
+	  // How many of the sequence's windows of len bases hold an N.
+	int windowsWithN(int len) const;
+	  // Bit 2i is set when base aPos+i of a differs from base bPos+i of b,
+	  // for the min(len, 32) bases compared.
+	static uint64_t mismatchMask(const PackedSequence& a, int aPos, const PackedSequence& b, int bPos, int len);
+	  // Number of mismatching bases between the two windows, counting stops
+	  // once it exceeds limit.
+	static int mismatches(const PackedSequence& a, int aPos, const PackedSequence& b, int bPos, int len, int limit);
+	  // Length of the longest prefix of the two windows, at most maxLen bases,
+	  // that differs in no more than mismatchesAllowed bases.
+	static int matchLength(const PackedSequence& a, int aPos, const PackedSequence& b, int bPos, int maxLen,
+		int mismatchesAllowed, Kernel kernel = SIMD_KERNEL);
+
+	static int code(char base);
+	  // How many of the count characters, from the first, are A, C, G, T or
+	  // N in either case.
+	static int validPrefix(const char* bases, int count);
+	static int popcount(uint64_t x);
+	static int lowestBase(uint64_t mask);
+
+	  // The words and N runs, as they are in memory.
+	template<typename Writer>
+	void save(Writer& out) const;
+	template<typename Reader>
+	bool load(Reader& in);
+private:
+	static int simdEqualBases(const PackedSequence& a, int aPos, const PackedSequence& b, int bPos, int maxLen);
+	static uint64_t bytesEqual(uint64_t x, unsigned char c);
+	static bool packWord(const char* bases, int count, uint64_t& word);
+
+	Storage<uint64_t> m_words;
+	Storage<NRun> m_nRuns;           // sorted by start, non-adjacent
+	int m_length;
+};
+
+inline void PackedSequence::countMemory(MemoryTally& tally) const
+{
+	tally.add(m_words);
+	tally.add(m_nRuns);
+}
+
+inline size_t PackedSequence::allocations() const
+{
+	return m_words.allocations() + m_nRuns.allocations();
+}
+
+inline int PackedSequence::code(char base)
+{
+	switch (base)
+	{
+	case 'A': case 'a': return 0;
+	case 'C': case 'c': return 1;
+	case 'G': case 'g': return 2;
+	case 'T': case 't': return 3;
+	default: return -1;
+	}
+}
+
+inline int PackedSequence::popcount(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	return (int)__popcnt64(x);
+#elif defined(__GNUC__)
+	return __builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & LOW_BITS);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+inline int PackedSequence::lowestBase(uint64_t mask)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long bit;
+	_BitScanForward64(&bit, mask);
+	return (int)bit / 2;
+#elif defined(__GNUC__)
+	return __builtin_ctzll(mask) / 2;
+#else
+	int bit = 0;
+	while ((mask & 1) == 0)
+	{
+		mask >>= 1;
+		bit++;
+	}
+	return bit / 2;
+#endif
+}
+
+inline uint64_t PackedSequence::bytesEqual(uint64_t x, unsigned char c)
+{
+	const uint64_t ONES = 0x0101010101010101ULL;
+	const uint64_t LOW7 = 0x7F7F7F7F7F7F7F7FULL;
+	uint64_t v = x ^ (c * ONES);
+	return ~(((v & LOW7) + LOW7) | v | LOW7);
+}
+
+// Packs up to 32 bases, 8 at a time, if they are all A, C, G or T in either case.
+inline bool PackedSequence::packWord(const char* bases, int count, uint64_t& word)
+{
+	const uint64_t ONES = 0x0101010101010101ULL;
+	char padded[BASES_PER_WORD];
+	if (count < BASES_PER_WORD)             //pad with As, which pack to zero bits
+	{
+		std::memset(padded, 'A', BASES_PER_WORD);
+		std::memcpy(padded, bases, count);
+		bases = padded;
+	}
+	uint64_t packed = 0;
+	for (int i = 0; i != BASES_PER_WORD / 8; i++)
+	{
+		uint64_t x;
+		std::memcpy(&x, bases + 8 * i, 8);
+		uint64_t u = x & (0xDF * ONES);           //upper case
+		if ((bytesEqual(u, 'A') | bytesEqual(u, 'C') | bytesEqual(u, 'G') | bytesEqual(u, 'T')) != 0x80 * ONES)
+			return false;
+		  //A, C, G and T in either case have their codes in bits 1-2 xor bits 2-3
+		uint64_t codes = ((x >> 1) ^ (x >> 2)) & (3 * ONES);
+		codes = (codes | (codes >> 6)) & 0x000F000F000F000FULL;
+		codes = (codes | (codes >> 12)) & 0x000000FF000000FFULL;
+		codes = (codes | (codes >> 24)) & 0xFFFF;
+		packed |= codes << (16 * i);
+	}
+	word = packed;
+	return true;
+}
+
+inline int PackedSequence::validPrefix(const char* bases, int count)
+{
+	const uint64_t ONES = 0x0101010101010101ULL;
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		uint64_t x;
+		std::memcpy(&x, bases + i, 8);
+		uint64_t u = x & (0xDF * ONES);
+		if ((bytesEqual(u, 'A') | bytesEqual(u, 'C') | bytesEqual(u, 'G') | bytesEqual(u, 'T')
+			| bytesEqual(u, 'N')) != 0x80 * ONES)
+			break;
+	}
+	for (; i < count; i++)
+	{
+		char u = bases[i] & 0xDF;
+		if (u != 'A' && u != 'C' && u != 'G' && u != 'T' && u != 'N')
+			break;
+	}
+	return i;
+}
+
+inline PackedSequence::PackedSequence()
+	:m_length(0)
+{}
+
+inline PackedSequence::PackedSequence(const std::string& bases)
+	:m_length(0)
+{
+	append(bases.data(), (int)bases.size());
+}
+
+inline void PackedSequence::reserve(int count)
+{
+	m_words.reserve((count + BASES_PER_WORD - 1) / BASES_PER_WORD);
+}
+
+inline void PackedSequence::shrinkToFit()
+{
+	m_words.shrink_to_fit();
+	m_nRuns.shrink_to_fit();
+}
+
+inline void PackedSequence::clear()
+{
+	m_words.clear();
+	m_nRuns.clear();
+	m_length = 0;
+}
+
+inline void PackedSequence::append(const char* bases, int count)
+{
+	m_words.resize((m_length + count + BASES_PER_WORD - 1) / BASES_PER_WORD);
+	for (int i = 0; i < count; i += BASES_PER_WORD)
+	{
+		int n = std::min(BASES_PER_WORD, count - i);
+		int pos = m_length + i;
+		uint64_t packed;
+		if (packWord(bases + i, n, packed))       //the words may not line up with the chunks
+		{
+			size_t w = pos / BASES_PER_WORD;
+			int shift = 2 * (pos % BASES_PER_WORD);
+			m_words[w] |= packed << shift;
+			if (shift != 0 && w + 1 < m_words.size())
+				m_words[w + 1] |= packed >> (64 - shift);
+			continue;
+		}
+		for (int j = pos; j < pos + n; j++)
+		{
+			int c = code(bases[j - m_length]);
+			if (c < 0)               //anything that isn't ACGT is kept as an N
+			{
+				if (!m_nRuns.empty() && m_nRuns.back().start + m_nRuns.back().length == (uint32_t)j)
+					m_nRuns.back().length++;
+				else
+					m_nRuns.push_back(NRun{ (uint32_t)j, 1 });
+				continue;
+			}
+			m_words[j / BASES_PER_WORD] |= (uint64_t)c << (2 * (j % BASES_PER_WORD));
+		}
+	}
+	m_length += count;
+}
+
+template<typename Writer>
+void PackedSequence::save(Writer& out) const
+{
+	out.value(m_length);
+	out.array(m_words.data(), m_words.size());
+	out.array(m_nRuns.data(), m_nRuns.size());
+}
+
+template<typename Reader>
+bool PackedSequence::load(Reader& in)
+{
+	return in.value(m_length) && m_length >= 0 && in.array(m_words) && in.array(m_nRuns)
+		&& m_words.size() == ((size_t)m_length + BASES_PER_WORD - 1) / BASES_PER_WORD;
+}
+
+inline int PackedSequence::length() const
+{
+	return m_length;
+}
+
+inline char PackedSequence::at(int pos) const
+{
+	static const char bases[] = { 'A', 'C', 'G', 'T' };
+	if (nMask(pos) & 1)
+		return 'N';
+	return bases[(m_words[pos / BASES_PER_WORD] >> (2 * (pos % BASES_PER_WORD))) & 3];
+}
+
+inline void PackedSequence::unpack(int pos, int len, std::string& out) const
+{
+	static const char bases[] = { 'A', 'C', 'G', 'T' };
+	out.resize(len);
+	for (int i = 0; i < len; i += BASES_PER_WORD)
+	{
+		uint64_t w = window(pos + i);
+		int n = std::min(BASES_PER_WORD, len - i);
+		for (int j = 0; j < n; j++, w >>= 2)
+			out[i + j] = bases[w & 3];
+	}
+	  // overwrite the N runs that overlap [pos, pos + len)
+	const NRun* it = std::upper_bound(m_nRuns.begin(), m_nRuns.end(), (uint32_t)pos,
+		[](uint32_t p, const NRun& r) { return p < r.start; });
+	if (it != m_nRuns.begin())
+		--it;
+	for (; it != m_nRuns.end() && it->start < (uint32_t)(pos + len); ++it)
+	{
+		int from = std::max((int)it->start, pos);
+		int to = std::min((int)(it->start + it->length), pos + len);
+		for (int j = from; j < to; j++)
+			out[j - pos] = 'N';
+	}
+}
+
+inline uint64_t PackedSequence::window(int pos) const
+{
+	size_t w = pos / BASES_PER_WORD;
+	int shift = 2 * (pos % BASES_PER_WORD);
+	if (w >= m_words.size())
+		return 0;
+	uint64_t bits = m_words[w] >> shift;
+	if (shift != 0 && w + 1 < m_words.size())
+		bits |= m_words[w + 1] << (64 - shift);
+	return bits;
+}
+
+inline uint64_t PackedSequence::nMask(int pos) const
+{
+	if (m_nRuns.empty())
+		return 0;
+	const NRun* it = std::upper_bound(m_nRuns.begin(), m_nRuns.end(), (uint32_t)pos,
+		[](uint32_t p, const NRun& r) { return p < r.start; });
+	if (it != m_nRuns.begin())
+		--it;
+	uint64_t mask = 0;
+	for (; it != m_nRuns.end() && it->start < (uint32_t)pos + BASES_PER_WORD; ++it)
+	{
+		int from = std::max((int)it->start, pos) - pos;
+		int to = std::min((int)(it->start + it->length) - pos, BASES_PER_WORD);
+		for (int j = from; j < to; j++)
+			mask |= 1ULL << (2 * j);
+	}
+	return mask;
+}
+
+inline bool PackedSequence::hasN(int pos, int len) const
+{
+	if (m_nRuns.empty() || len <= 0)
+		return false;
+	const NRun* it = std::upper_bound(m_nRuns.begin(), m_nRuns.end(), (uint32_t)(pos + len - 1),
+		[](uint32_t p, const NRun& r) { return p < r.start; });
+	if (it == m_nRuns.begin())
+		return false;
+	--it;                                //last run starting at or before the end of the window
+	return it->start + it->length > (uint32_t)pos;
+}
+
+inline int PackedSequence::windowsWithN(int len) const
+{
+	int count = 0;
+	int counted = 0;                      //windows starting before this are counted
+	for (const NRun& r : m_nRuns)
+	{
+		int from = std::max(counted, (int)r.start - len + 1);
+		int to = std::min((int)(r.start + r.length), m_length - len + 1);
+		if (from < to)
+		{
+			count += to - from;
+			counted = to;
+		}
+	}
+	return count;
+}
+
+inline uint64_t PackedSequence::mismatchMask(const PackedSequence& a, int aPos, const PackedSequence& b, int bPos, int len)
+{
+	uint64_t diff = a.window(aPos) ^ b.window(bPos);
+	uint64_t mask = (diff | (diff >> 1)) & LOW_BITS;
+	uint64_t na = a.nMask(aPos);
+	uint64_t nb = b.nMask(bPos);
+	if (na | nb)
+		mask = (mask & ~(na | nb)) | (na ^ nb);      //N only matches N
+	if (len < BASES_PER_WORD)
+		mask &= (1ULL << (2 * len)) - 1;
+	return mask;
+}
+
+inline int PackedSequence::mismatches(const PackedSequence& a, int aPos, const PackedSequence& b, int bPos, int len, int limit)
+{
+	int count = 0;
+	for (int i = 0; i < len && count <= limit; i += BASES_PER_WORD)
+		count += popcount(mismatchMask(a, aPos + i, b, bPos + i, len - i));
+	return count;
+}
+
+inline int PackedSequence::matchLength(const PackedSequence& a, int aPos, const PackedSequence& b, int bPos, int maxLen,
+	int mismatchesAllowed, Kernel kernel)
+{
+	if (kernel == SCALAR_KERNEL)
+	{
+		for (int len = 0; len < maxLen; len++)
+		{
+			if (a.at(aPos + len) != b.at(bPos + len) && mismatchesAllowed-- == 0)
+				return len;
+		}
+		return maxLen;
+	}
+
+	  //without Ns in either window a plain XOR of the words finds every mismatch
+	bool plain = !a.hasN(aPos, maxLen) && !b.hasN(bPos, maxLen);
+	int len = 0;
+	while (len < maxLen)
+	{
+		if (kernel == SIMD_KERNEL && plain)
+			len += simdEqualBases(a, aPos + len, b, bPos + len, maxLen - len);
+		if (len >= maxLen)
+			break;
+		int n = std::min(BASES_PER_WORD, maxLen - len);
+		uint64_t mask;
+		if (plain)
+		{
+			uint64_t diff = a.window(aPos + len) ^ b.window(bPos + len);
+			mask = (diff | (diff >> 1)) & LOW_BITS;
+			if (n < BASES_PER_WORD)
+				mask &= (1ULL << (2 * n)) - 1;
+		}
+		else
+			mask = mismatchMask(a, aPos + len, b, bPos + len, n);
+		while (mask != 0 && mismatchesAllowed > 0)    //spend the allowed mismatches on the earliest ones
+		{
+			mask &= mask - 1;
+			mismatchesAllowed--;
+		}
+		if (mask != 0)
+			return len + lowestBase(mask);
+		len += n;
+	}
+	return maxLen;
+}
+
+// Number of leading bases, in whole SIMD blocks, that are identical in the
+// two windows.  Only valid when neither window contains an N.
+inline int PackedSequence::simdEqualBases(const PackedSequence& a, int aPos, const PackedSequence& b, int bPos, int maxLen)
+{
+#if defined(PACKEDSEQUENCE_AVX2) || defined(PACKEDSEQUENCE_SSE2)
+#if defined(PACKEDSEQUENCE_AVX2)
+	const int WORDS = 4;
+#else
+	const int WORDS = 2;
+#endif
+	const int BLOCK = WORDS * BASES_PER_WORD;
+	size_t ja = aPos / BASES_PER_WORD, jb = bPos / BASES_PER_WORD;
+	__m128i sa = _mm_cvtsi32_si128(2 * (aPos % BASES_PER_WORD));
+	__m128i sb = _mm_cvtsi32_si128(2 * (bPos % BASES_PER_WORD));
+	__m128i ra = _mm_cvtsi32_si128(64 - 2 * (aPos % BASES_PER_WORD));    //a shift of 64 yields 0
+	__m128i rb = _mm_cvtsi32_si128(64 - 2 * (bPos % BASES_PER_WORD));
+	int len = 0;
+	  //each block of windows is built from two overlapping unaligned loads
+	while (len + BLOCK <= maxLen && ja + WORDS < a.m_words.size() && jb + WORDS < b.m_words.size())
+	{
+		const uint64_t* wa = &a.m_words[ja];
+		const uint64_t* wb = &b.m_words[jb];
+#if defined(PACKEDSEQUENCE_AVX2)
+		__m256i winA = _mm256_or_si256(_mm256_srl_epi64(_mm256_loadu_si256((const __m256i*)wa), sa),
+			_mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(wa + 1)), ra));
+		__m256i winB = _mm256_or_si256(_mm256_srl_epi64(_mm256_loadu_si256((const __m256i*)wb), sb),
+			_mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(wb + 1)), rb));
+		__m256i diff = _mm256_xor_si256(winA, winB);
+		if (!_mm256_testz_si256(diff, diff))
+			break;
+#else
+		__m128i winA = _mm_or_si128(_mm_srl_epi64(_mm_loadu_si128((const __m128i*)wa), sa),
+			_mm_sll_epi64(_mm_loadu_si128((const __m128i*)(wa + 1)), ra));
+		__m128i winB = _mm_or_si128(_mm_srl_epi64(_mm_loadu_si128((const __m128i*)wb), sb),
+			_mm_sll_epi64(_mm_loadu_si128((const __m128i*)(wb + 1)), rb));
+		__m128i diff = _mm_xor_si128(winA, winB);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+			break;
+#endif
+		len += BLOCK;
+		ja += WORDS;
+		jb += WORDS;
+	}
+	return len;
+#else
+	(void)a; (void)aPos; (void)b; (void)bPos; (void)maxLen;
+	return 0;
+#endif
+}
+
+#endif // PACKEDSEQUENCE_INCLUDED
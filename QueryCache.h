@@ -0,0 +1,208 @@
+#ifndef QUERYCACHE_INCLUDED
+#define QUERYCACHE_INCLUDED
+
+#include "Storage.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <cstddef>
+
+// A bounded map from query keys to results that many threads can use at
+// once.  Keys are spread over several shards, each with its own lock, so
+// threads looking up different keys rarely wait for each other.  A full
+// shard evicts with the CLOCK algorithm: a lookup marks its entry as used,
+// and the hand sweeping for a slot to reuse clears the marks it passes and
+// takes the first entry that isn't marked, which approximates evicting the
+// least recently used entry without reordering anything on a hit.  A
+// capacity of 0 turns the cache off.
+template<typename Value>
+class QueryCache
+{
+public:
+	explicit QueryCache(size_t capacity = 0);
+	void setCapacity(size_t capacity);    // also empties the cache
+	size_t capacity() const;
+	  // If key is cached, calls visit(value) while holding its shard's lock
+	  // and returns true.
+	template<typename Visit>
+	bool find(const std::string& key, Visit visit);
+	  // Stores value under key unless key is cached already.  Returns the
+	  // number of blocks storing it allocated besides value's own (the map
+	  // node and the key's copy unless it is short), or 0 if it didn't.
+	size_t insert(const std::string& key, Value value);
+	void clear();
+	size_t size() const;
+	size_t hits() const;
+	size_t misses() const;
+	  // Adds the memory of the cache to tally, calling countValue(value,
+	  // tally) for what each value holds outside the cache.
+	template<typename CountValue>
+	void countMemory(MemoryTally& tally, CountValue countValue) const;
+private:
+	static constexpr size_t SHARDS = 16;
+	static constexpr size_t SHORT_STRING = 15;    // kept inside the string object, at least by libstdc++
+	struct Entry
+	{
+		const std::string* key;           // the map's copy
+		Value value;
+		bool used;
+	};
+	struct Shard
+	{
+		mutable std::mutex mutex;
+		std::unordered_map<std::string, size_t> slots;    // key to index in entries
+		std::vector<Entry> entries;
+		size_t hand = 0;
+	};
+	std::unique_ptr<Shard[]> m_shards;
+	std::atomic<size_t> m_capacity;       // may change while other threads look things up
+	std::atomic<size_t> m_shardCapacity;
+	std::atomic<size_t> m_hits;
+	std::atomic<size_t> m_misses;
+
+	Shard& shardOf(const std::string& key);
+};
+
+template<typename Value>
+QueryCache<Value>::QueryCache(size_t capacity)
+	:m_shards(new Shard[SHARDS]), m_capacity(0), m_shardCapacity(0), m_hits(0), m_misses(0)
+{
+	setCapacity(capacity);
+}
+
+template<typename Value>
+void QueryCache<Value>::setCapacity(size_t capacity)
+{
+	m_capacity = capacity;
+	m_shardCapacity = capacity == 0 ? 0 : std::max(capacity / SHARDS, (size_t)1);    //every shard keeps one at least
+	clear();                              //after, so nothing inserted meanwhile is over the old capacity
+}
+
+template<typename Value>
+size_t QueryCache<Value>::capacity() const
+{
+	return m_capacity;
+}
+
+template<typename Value>
+template<typename Visit>
+bool QueryCache<Value>::find(const std::string& key, Visit visit)
+{
+	if (m_capacity == 0)
+		return false;
+	Shard& shard = shardOf(key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto it = shard.slots.find(key);
+	if (it == shard.slots.end())
+	{
+		m_misses++;
+		return false;
+	}
+	Entry& entry = shard.entries[it->second];
+	entry.used = true;
+	m_hits++;
+	visit(entry.value);
+	return true;
+}
+
+template<typename Value>
+size_t QueryCache<Value>::insert(const std::string& key, Value value)
+{
+	const size_t shardCapacity = m_shardCapacity;
+	if (shardCapacity == 0)
+		return 0;
+	Shard& shard = shardOf(key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto inserted = shard.slots.insert(std::make_pair(key, shard.entries.size()));
+	if (!inserted.second)                 //another thread got here first
+		return 0;
+	const size_t allocated = 1 + (key.size() > SHORT_STRING);
+	if (shard.entries.size() < shardCapacity)
+	{
+		shard.entries.push_back(Entry{ &inserted.first->first, std::move(value), false });
+		return allocated;
+	}
+	while (shard.entries[shard.hand].used)      //give each used entry a second chance
+	{
+		shard.entries[shard.hand].used = false;
+		shard.hand = (shard.hand + 1) % shard.entries.size();
+	}
+	Entry& victim = shard.entries[shard.hand];
+	shard.slots.erase(*victim.key);
+	inserted.first->second = shard.hand;
+	victim.key = &inserted.first->first;
+	victim.value = std::move(value);
+	shard.hand = (shard.hand + 1) % shard.entries.size();
+	return allocated;
+}
+
+template<typename Value>
+void QueryCache<Value>::clear()
+{
+	for (size_t s = 0; s != SHARDS; s++)
+	{
+		Shard& shard = m_shards[s];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.slots.clear();
+		shard.entries.clear();
+		shard.hand = 0;
+	}
+}
+
+template<typename Value>
+size_t QueryCache<Value>::size() const
+{
+	size_t total = 0;
+	for (size_t s = 0; s != SHARDS; s++)
+	{
+		std::lock_guard<std::mutex> lock(m_shards[s].mutex);
+		total += m_shards[s].entries.size();
+	}
+	return total;
+}
+
+template<typename Value>
+size_t QueryCache<Value>::hits() const
+{
+	return m_hits;
+}
+
+template<typename Value>
+size_t QueryCache<Value>::misses() const
+{
+	return m_misses;
+}
+
+template<typename Value>
+template<typename CountValue>
+void QueryCache<Value>::countMemory(MemoryTally& tally, CountValue countValue) const
+{
+	for (size_t s = 0; s != SHARDS; s++)
+	{
+		const Shard& shard = m_shards[s];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		tally.add(shard.entries);
+		tally.add(shard.slots.bucket_count() * sizeof(void*));
+		for (const auto& slot : shard.slots)
+		{
+			tally.add(sizeof(slot) + 2 * sizeof(void*));    //the node, with its link and hash
+			if (slot.first.capacity() > SHORT_STRING)
+				tally.add(slot.first.capacity() + 1);
+		}
+		for (const Entry& entry : shard.entries)
+			countValue(entry.value, tally);
+	}
+}
+
+template<typename Value>
+typename QueryCache<Value>::Shard& QueryCache<Value>::shardOf(const std::string& key)
+{
+	return m_shards[std::hash<std::string>()(key) % SHARDS];
+}
+
+#endif // QUERYCACHE_INCLUDED
@@ -0,0 +1,155 @@
+#ifndef SKETCH_INCLUDED
+#define SKETCH_INCLUDED
+
+#include "PackedSequence.h"
+#include "KmerIndex.h"
+#include "Storage.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// A MinHash sketch of a sequence's k-mers: the hashes of its k-mers that
+// fall in the lowest 1 / SCALE of the hash range (a fractional, or scaled,
+// MinHash).  Every sketch samples the same part of the hash range, so the
+// hashes two sketches share are a sample of the k-mers the sequences share,
+// and |A's sketch and B's| / |A's sketch| estimates how much of A is in B
+// however different their lengths.
+class Sketch
+{
+public:
+	static constexpr int KMER_LENGTH = 12;
+	static constexpr uint64_t SCALE = 200;
+
+	void build(const PackedSequence& sequence);
+	size_t size() const;
+	const uint64_t* begin() const;
+	const uint64_t* end() const;
+	void countMemory(MemoryTally& tally) const;
+
+	  // Only the hashes are saved.
+	template<typename Writer>
+	void save(Writer& out) const;
+	template<typename Reader>
+	bool load(Reader& in);
+private:
+	Storage<uint64_t> m_hashes;           // sorted, without repeats
+};
+
+inline void Sketch::build(const PackedSequence& sequence)
+{
+	const uint64_t mask = (1ULL << (2 * KMER_LENGTH)) - 1;
+	const uint64_t limit = ~0ULL / SCALE;
+	std::string bases;
+	sequence.unpack(0, sequence.length(), bases);
+	std::vector<uint64_t> hashes;
+	uint64_t code = 0;
+	int lastN = -1;
+	for (int i = 0; i != (int)bases.size(); i++)
+	{
+		int c = PackedSequence::code(bases[i]);
+		if (c < 0 || bases[i] == 'N')
+		{
+			lastN = i;
+			c = 0;
+		}
+		code = ((code << 2) | c) & mask;
+		if (i - KMER_LENGTH + 1 <= lastN)     //too close to the start or to an N
+			continue;
+		uint64_t h = KmerIndex::hash(code);
+		if (h < limit)
+			hashes.push_back(h);
+	}
+	std::sort(hashes.begin(), hashes.end());
+	hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+	hashes.shrink_to_fit();
+	m_hashes.clear();
+	m_hashes.swap(hashes);
+}
+
+inline size_t Sketch::size() const
+{
+	return m_hashes.size();
+}
+
+inline const uint64_t* Sketch::begin() const
+{
+	return m_hashes.begin();
+}
+
+inline const uint64_t* Sketch::end() const
+{
+	return m_hashes.end();
+}
+
+inline void Sketch::countMemory(MemoryTally& tally) const
+{
+	tally.add(m_hashes);
+}
+
+template<typename Writer>
+void Sketch::save(Writer& out) const
+{
+	out.array(m_hashes.data(), m_hashes.size());
+}
+
+template<typename Reader>
+bool Sketch::load(Reader& in)
+{
+	return in.array(m_hashes);
+}
+
+// Every hash of a set of sketches, sorted, with the sketch it came from, so
+// counting what a query sketch shares with each of them looks up only the
+// query's hashes instead of walking every sketch.
+class SketchIndex
+{
+public:
+	void build(const std::vector<Sketch>& sketches);
+	  // Sets shared[i] to the number of hashes query shares with sketch i.
+	void count(const Sketch& query, std::vector<int>& shared) const;
+	void countMemory(MemoryTally& tally) const;
+private:
+	struct Entry
+	{
+		uint64_t hash;
+		uint32_t sketch;
+	};
+	std::vector<Entry> m_entries;
+	size_t m_sketches = 0;
+};
+
+inline void SketchIndex::build(const std::vector<Sketch>& sketches)
+{
+	m_entries.clear();
+	for (size_t i = 0; i != sketches.size(); i++)
+	{
+		for (uint64_t h : sketches[i])
+			m_entries.push_back(Entry{ h, (uint32_t)i });
+	}
+	std::sort(m_entries.begin(), m_entries.end(), [](const Entry& lhs, const Entry& rhs) {
+		return lhs.hash < rhs.hash;
+	});
+	m_sketches = sketches.size();
+}
+
+inline void SketchIndex::countMemory(MemoryTally& tally) const
+{
+	tally.add(m_entries);
+}
+
+inline void SketchIndex::count(const Sketch& query, std::vector<int>& shared) const
+{
+	shared.assign(m_sketches, 0);
+	auto e = m_entries.begin();
+	for (uint64_t h : query)              //both sorted, so each search starts where the last stopped
+	{
+		e = std::lower_bound(e, m_entries.end(), h, [](const Entry& entry, uint64_t hash) {
+			return entry.hash < hash;
+		});
+		for (; e != m_entries.end() && e->hash == h; e++)
+			shared[e->sketch]++;
+	}
+}
+
+#endif // SKETCH_INCLUDED
@@ -0,0 +1,319 @@
+#ifndef STORAGE_INCLUDED
+#define STORAGE_INCLUDED
+
+#include <vector>
+#include <cstddef>
+
+// An array that either owns its elements in a vector or views elements that
+// live somewhere else, such as in a memory-mapped index file.  Reading is the
+// same either way; the first change to a viewed array copies it into a vector
+// of its own, so the memory it views is never written.  Copies of a view are
+// views of the same memory, which must outlive all of them.
+template<typename T>
+class Storage
+{
+public:
+	Storage();
+	Storage(size_t count, const T& value);
+	Storage(const Storage& other);
+	Storage(Storage&& other) noexcept;
+	Storage& operator=(const Storage& rhs);
+	Storage& operator=(Storage&& rhs) noexcept;
+
+	void view(const T* data, size_t count);
+	bool isView() const;
+
+	size_t size() const;
+	bool empty() const;
+	size_t capacity() const;              // elements owned; a view owns none
+	size_t allocations() const;           // blocks allocated to hold them so far
+	const T* data() const;
+	const T* begin() const;
+	const T* end() const;
+	const T& operator[](size_t i) const;
+	const T& back() const;
+
+	T& operator[](size_t i);
+	T& back();
+	void push_back(const T& value);
+	void resize(size_t count);
+	void assign(size_t count, const T& value);
+	void reserve(size_t count);
+	void shrink_to_fit();
+	void clear();
+	void swap(std::vector<T>& other);
+private:
+	std::vector<T> m_owned;
+	const T* m_data;                      // m_owned's elements, or the viewed ones
+	size_t m_size;
+	bool m_viewing;
+	size_t m_allocations;
+
+	std::vector<T>& own();
+	void sync();
+};
+
+template<typename T>
+Storage<T>::Storage()
+	:m_data(nullptr), m_size(0), m_viewing(false), m_allocations(0)
+{}
+
+template<typename T>
+Storage<T>::Storage(size_t count, const T& value)
+	:m_owned(count, value), m_data(nullptr), m_viewing(false), m_allocations(0)
+{
+	sync();
+}
+
+template<typename T>
+Storage<T>::Storage(const Storage& other)
+	:m_owned(other.m_owned), m_data(other.m_data), m_size(other.m_size), m_viewing(other.m_viewing), m_allocations(0)
+{
+	if (!m_viewing)
+		sync();
+}
+
+template<typename T>
+Storage<T>::Storage(Storage&& other) noexcept
+	:m_owned(std::move(other.m_owned)), m_data(other.m_data), m_size(other.m_size), m_viewing(other.m_viewing),
+	m_allocations(other.m_allocations)
+{
+	other.m_viewing = false;
+	other.m_allocations = 0;
+	other.sync();
+}
+
+template<typename T>
+Storage<T>& Storage<T>::operator=(const Storage& rhs)
+{
+	if (this != &rhs)
+	{
+		m_owned = rhs.m_owned;
+		m_viewing = rhs.m_viewing;
+		m_data = rhs.m_data;
+		m_size = rhs.m_size;
+		if (!m_viewing)
+			sync();
+	}
+	return *this;
+}
+
+template<typename T>
+Storage<T>& Storage<T>::operator=(Storage&& rhs) noexcept
+{
+	if (this != &rhs)
+	{
+		m_owned = std::move(rhs.m_owned);
+		m_viewing = rhs.m_viewing;
+		m_data = rhs.m_data;
+		m_size = rhs.m_size;
+		m_allocations = rhs.m_allocations;
+		rhs.m_owned.clear();
+		rhs.m_viewing = false;
+		rhs.m_allocations = 0;
+		rhs.sync();
+	}
+	return *this;
+}
+
+template<typename T>
+void Storage<T>::view(const T* data, size_t count)
+{
+	std::vector<T>().swap(m_owned);
+	m_data = data;
+	m_size = count;
+	m_viewing = true;
+}
+
+template<typename T>
+bool Storage<T>::isView() const
+{
+	return m_viewing;
+}
+
+template<typename T>
+size_t Storage<T>::size() const
+{
+	return m_size;
+}
+
+template<typename T>
+bool Storage<T>::empty() const
+{
+	return m_size == 0;
+}
+
+template<typename T>
+size_t Storage<T>::capacity() const
+{
+	return m_owned.capacity();
+}
+
+template<typename T>
+size_t Storage<T>::allocations() const
+{
+	return m_allocations;
+}
+
+template<typename T>
+const T* Storage<T>::data() const
+{
+	return m_data;
+}
+
+template<typename T>
+const T* Storage<T>::begin() const
+{
+	return m_data;
+}
+
+template<typename T>
+const T* Storage<T>::end() const
+{
+	return m_data + m_size;
+}
+
+template<typename T>
+const T& Storage<T>::operator[](size_t i) const
+{
+	return m_data[i];
+}
+
+template<typename T>
+const T& Storage<T>::back() const
+{
+	return m_data[m_size - 1];
+}
+
+template<typename T>
+T& Storage<T>::operator[](size_t i)
+{
+	return own()[i];
+}
+
+template<typename T>
+T& Storage<T>::back()
+{
+	return own().back();
+}
+
+template<typename T>
+void Storage<T>::push_back(const T& value)
+{
+	own().push_back(value);
+	sync();
+}
+
+template<typename T>
+void Storage<T>::resize(size_t count)
+{
+	own().resize(count);
+	sync();
+}
+
+template<typename T>
+void Storage<T>::assign(size_t count, const T& value)
+{
+	m_viewing = false;                    //nothing to copy
+	m_owned.assign(count, value);
+	sync();
+}
+
+template<typename T>
+void Storage<T>::reserve(size_t count)
+{
+	own().reserve(count);
+	sync();
+}
+
+template<typename T>
+void Storage<T>::shrink_to_fit()
+{
+	if (m_viewing)                        //a view takes no memory
+		return;
+	m_owned.shrink_to_fit();
+	sync();
+}
+
+template<typename T>
+void Storage<T>::clear()
+{
+	m_viewing = false;
+	m_owned.clear();
+	sync();
+}
+
+template<typename T>
+void Storage<T>::swap(std::vector<T>& other)
+{
+	own().swap(other);
+	sync();
+}
+
+template<typename T>
+std::vector<T>& Storage<T>::own()
+{
+	if (m_viewing)                        //copy on first write
+	{
+		m_owned.assign(m_data, m_data + m_size);
+		m_viewing = false;
+		sync();
+	}
+	return m_owned;
+}
+
+template<typename T>
+void Storage<T>::sync()
+{
+	if (m_owned.data() != m_data && m_owned.capacity() != 0)    //the vector moved to a new block
+		m_allocations++;
+	m_data = m_owned.data();
+	m_size = m_owned.size();
+}
+
+// Adds up the memory of the arrays making up a structure, for memory
+// accounting.  bytes is what the owned arrays hold, overhead an estimate of
+// what the allocator adds to each block (glibc's malloc gives a small block a
+// header and rounds it to 16 bytes, and maps a large one in whole pages), and
+// mapped what the views see in memory they don't own.
+struct MemoryTally
+{
+	size_t bytes = 0;
+	size_t overhead = 0;
+	size_t mapped = 0;
+
+	void add(size_t blockBytes);
+	template<typename T>
+	void add(const Storage<T>& s);
+	template<typename T>
+	void add(const std::vector<T>& v);
+};
+
+inline void MemoryTally::add(size_t blockBytes)
+{
+	const size_t MMAP_THRESHOLD = 128 * 1024;
+	const size_t PAGE = 4096;
+	if (blockBytes == 0)
+		return;
+	size_t chunk = blockBytes >= MMAP_THRESHOLD ? (blockBytes + 16 + PAGE - 1) / PAGE * PAGE
+		: (blockBytes + 8 + 15) / 16 * 16;
+	bytes += blockBytes;
+	overhead += chunk - blockBytes;
+}
+
+template<typename T>
+void MemoryTally::add(const Storage<T>& s)
+{
+	if (s.isView())
+		mapped += s.size() * sizeof(T);
+	else
+		add(s.capacity() * sizeof(T));
+}
+
+template<typename T>
+void MemoryTally::add(const std::vector<T>& v)
+{
+	add(v.capacity() * sizeof(T));
+}
+
+#endif // STORAGE_INCLUDED
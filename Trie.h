@@ -3,8 +3,18 @@
 
 #include <string>
 #include <vector>
-#include <list>
+#include <cstdint>
+#include <utility>
+#include "Storage.h"
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
 
+// A trie over DNA keys (A, C, G, T and N).  All nodes live in one contiguous
+// pool and refer to their children by 32-bit index; each node's values are
+// an offset range into a separate packed value array, so neither inserting
+// nor finding allocates per node, and destroying or resetting a trie frees
+// two blocks however many keys it holds.
 template<typename ValueType>
 class Trie
 {
@@ -14,127 +24,386 @@ public:
     void reset();
     void insert(const std::string& key, const ValueType& value);
     std::vector<ValueType> find(const std::string& key, bool exactMatchOnly) const;
+      // Looks up the keyLength bases at key like the other find, but calls
+      // visit(values, valueCount) with each matching node's values where
+      // they lie in the trie instead of copying them, so it never allocates.
+      // Returns the number of nodes it visited.
+    template<typename Visit>
+    size_t find(const char* key, size_t keyLength, bool exactMatchOnly, Visit visit) const;
+      // Looks up keyCount keys of keyLength bases exactly, calling
+      // found(i, values, valueCount) for each key i that is in the trie.
+      // The keys are walked a group at a time, one level of every key in
+      // the group per step, so the memory accesses of different keys
+      // overlap; keys sorted so that shared prefixes are adjacent also find
+      // most of their nodes already in cache.  Returns the number of nodes
+      // it visited.
+    template<typename Found>
+    size_t findBatch(const char* const* keys, size_t keyCount, size_t keyLength, Found found) const;
+    void merge(const Trie& other);
+    void swap(Trie& other);
+      // Whether a trie can hold keyCount keys of keyLength bases.  Nodes and
+      // values are found by 32-bit offsets, and the value pool can take up
+      // to four times as many values as there are, counting the room ranges
+      // grow into and the ranges they leave behind.
+    static bool fits(size_t keyCount, size_t keyLength);
+
+      // The number of blocks the node and value pools have allocated since
+      // the trie was made or last reset.  The pools grow geometrically, so
+      // the count grows with the log of the size.
+    size_t allocations() const;
+      // Adds the memory of the nodes (with the pools' free lists) to nodes
+      // and of the values to values.
+    void countMemory(MemoryTally& nodes, MemoryTally& values) const;
+
+      // Saves the node and value pools.  A loaded trie views them until the
+      // first insert copies them.
+    template<typename Writer>
+    void save(Writer& out) const;
+    template<typename Reader>
+    bool load(Reader& in);
 
       // C++11 syntax for preventing copying and assignment
     Trie(const Trie&) = delete;
     Trie& operator=(const Trie&) = delete;
 private:
+	static const int ALPHABET = 5;        // A, C, G, T, N
+	static const int MAX_CLASSES = 32;    // value ranges have power-of-two capacities
+
 	struct Node
 	{
-		char label = ' ';
-		std::list<ValueType> vals;
-		std::list<Node*> chn;
+		uint32_t chn[ALPHABET] = {};      // 0 means no child (the root is never a child)
+		uint32_t valOffset = 0;
+		uint32_t valCount = 0;
+		uint32_t valCapacity = 0;
 	};
-	Node* m_root;
-	void deleteTree(Node* cur);
-	void insertHelper(Node* cur, const std::string & key, const ValueType & value);
-	std::vector<ValueType> findHelper(Node* cur, const std::string & key,
-		std::vector<ValueType>& matches, bool exactMatchesOnly, bool notfirstChar) const;
+	Storage<Node> m_nodes;                // m_nodes[0] is the root
+	Storage<ValueType> m_vals;
+	std::vector<uint32_t> m_freeRanges[MAX_CLASSES];   // abandoned ranges, by log2 of capacity
+
+	static const size_t BATCH_GROUP = 8;  // keys walked side by side by findBatch
+
+	static int slot(char c);
+	static void prefetch(const void* p);
+	uint32_t allocateRange(uint32_t capacity);
+	void appendValue(uint32_t node, const ValueType& value);
+	void appendValues(uint32_t node, const ValueType* values, uint32_t count);
+	template<typename Visit>
+	size_t findHelper(uint32_t cur, const char* key, size_t keyLength, size_t depth,
+		bool exactMatchesOnly, Visit& visit) const;
 };
 
 
 template<typename ValueType>
 Trie<ValueType>::Trie()
 {
-	m_root = new Node;
+	m_nodes.push_back(Node());
 }
 
 template<typename ValueType>
 Trie<ValueType>::~Trie()
+{}
+
+template<typename ValueType>
+void Trie<ValueType>::reset()             //this is a trie
 {
-	deleteTree(m_root);
+	m_nodes = Storage<Node>();        //no per-node frees: constant time for trivially destructible values
+	m_vals = Storage<ValueType>();
+	for (int i = 0; i != MAX_CLASSES; i++)
+		std::vector<uint32_t>().swap(m_freeRanges[i]);
+	m_nodes.push_back(Node());
 }
 
 template<typename ValueType>
-void Trie<ValueType>::reset()             //this is a trie
+int Trie<ValueType>::slot(char c)
 {
-	deleteTree(m_root);
-	m_root = new Node;
+	switch (c)
+	{
+	case 'A': return 0;
+	case 'C': return 1;
+	case 'G': return 2;
+	case 'T': return 3;
+	case 'N': return 4;
+	default: return -1;
+	}
 }
 
 template<typename ValueType>
 void Trie<ValueType>::insert(const std::string & key, const ValueType & value)
 {
-	insertHelper(m_root, key, value);
+	uint32_t cur = 0;
+	for (size_t i = 0; i != key.size(); i++)
+	{
+		int s = slot(key[i]);
+		if (s < 0)
+			return;                          //not a DNA key
+		if (m_nodes[cur].chn[s] == 0)          //no children match the key, so make a child
+		{
+			uint32_t newChild = (uint32_t)m_nodes.size();
+			m_nodes.push_back(Node());
+			m_nodes[cur].chn[s] = newChild;
+		}
+		cur = m_nodes[cur].chn[s];
+	}
+	appendValue(cur, value);
 }
 
 template<typename ValueType>
-void Trie<ValueType>::insertHelper(Node* cur, const std::string & key, const ValueType & value) 
+uint32_t Trie<ValueType>::allocateRange(uint32_t capacity)
 {
-	typename std::list<Node*>::iterator it = cur->chn.begin();
-	for (; it != cur->chn.end(); it++)
+	int cls = 0;
+	while ((1u << cls) < capacity)
+		cls++;
+	std::vector<uint32_t>& freeList = m_freeRanges[cls];
+	if (!freeList.empty())
 	{
-		Node* child = *it;
-		if (key[0] == child->label)                          //key char matches label of a child
+		uint32_t offset = freeList.back();
+		freeList.pop_back();
+		return offset;
+	}
+	uint32_t offset = (uint32_t)m_vals.size();
+	m_vals.resize(m_vals.size() + capacity);
+	return offset;
+}
+
+template<typename ValueType>
+void Trie<ValueType>::appendValue(uint32_t node, const ValueType & value)
+{
+	appendValues(node, &value, 1);
+}
+
+template<typename ValueType>
+void Trie<ValueType>::appendValues(uint32_t node, const ValueType* values, uint32_t count)
+{
+	Node* n = &m_nodes[node];
+	if (n->valCount + count > n->valCapacity)       //range is full, move it to a power-of-two range that fits
+	{
+		uint32_t newCapacity = 1;
+		while (newCapacity < n->valCount + count)
+			newCapacity *= 2;
+		if (n->valCapacity != 0 && n->valOffset + n->valCapacity == m_vals.size())
+		{
+			m_vals.resize(n->valOffset + newCapacity);      //last range in the pool grows in place
+		}
+		else
 		{
-			if (key.size() == 1) 
-				child->vals.push_back(value);
-			else
-				insertHelper(child, key.substr(1), value);       //so go into that child
-			return;
+			uint32_t newOffset = allocateRange(newCapacity);
+			n = &m_nodes[node];
+			for (uint32_t i = 0; i != n->valCount; i++)
+				m_vals[newOffset + i] = m_vals[n->valOffset + i];
+			if (n->valCapacity != 0)
+			{
+				int cls = 0;
+				while ((2u << cls) <= n->valCapacity)
+					cls++;
+				m_freeRanges[cls].push_back(n->valOffset);
+			}
+			n->valOffset = newOffset;
 		}
+		n->valCapacity = newCapacity;
 	}
-	
-	Node* newChild = new Node;     //here, no children match the key, so make a child
-	newChild->label = key[0];
-	cur->chn.push_back(newChild);
-
-	if (key.size() == 1)
-		newChild->vals.push_back(value);
-	else
-		insertHelper(newChild, key.substr(1), value);
+	for (uint32_t i = 0; i != count; i++)
+		m_vals[n->valOffset + n->valCount + i] = values[i];
+	n->valCount += count;
 }
 
 template<typename ValueType>
 std::vector<ValueType> Trie<ValueType>::find(const std::string & key, bool exactMatchOnly) const
 {
 	std::vector<ValueType> matches;
-	findHelper(m_root, key, matches, exactMatchOnly, false);
+	find(key.data(), key.size(), exactMatchOnly, [&matches](const ValueType* values, uint32_t count) {
+		matches.insert(matches.end(), values, values + count);
+	});
 	return matches;
 }
 
 template<typename ValueType>
-std::vector<ValueType> Trie<ValueType>::findHelper(Node* cur, const std::string & key, 
-	std::vector<ValueType>& matches, bool exactMatchesOnly, bool notfirstChar) const
-{ 
-	bool b = exactMatchesOnly;
-	typename std::list<Node*>::iterator it = cur->chn.begin();
-	for (; it != cur->chn.end(); it++)
+template<typename Visit>
+size_t Trie<ValueType>::find(const char* key, size_t keyLength, bool exactMatchOnly, Visit visit) const
+{
+	return findHelper(0, key, keyLength, 0, exactMatchOnly, visit);
+}
+
+template<typename ValueType>
+void Trie<ValueType>::prefetch(const void* p)
+{
+#if defined(__GNUC__)
+	__builtin_prefetch(p);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#else
+	(void)p;
+#endif
+}
+
+template<typename ValueType>
+template<typename Found>
+size_t Trie<ValueType>::findBatch(const char* const* keys, size_t keyCount, size_t keyLength, Found found) const
+{
+	const uint32_t NONE = ~0u;            //the key left the trie
+	uint32_t cur[BATCH_GROUP];
+	size_t visited = 0;
+	for (size_t first = 0; first < keyCount; first += BATCH_GROUP)
 	{
-		Node* child = *it;
-		if (key[0] == child->label || (!b && notfirstChar))
+		size_t n = keyCount - first < BATCH_GROUP ? keyCount - first : BATCH_GROUP;
+		for (size_t i = 0; i != n; i++)
+			cur[i] = 0;
+		visited += n;                      //the root
+		for (size_t depth = 0; depth != keyLength; depth++)
 		{
-			if (key.size() == 1) {
-				typename std::list<ValueType>::iterator valsIt = child->vals.begin();
-				for (; valsIt != child->vals.end(); valsIt++) {
-					matches.push_back(*valsIt);
+			for (size_t i = 0; i != n; i++)
+			{
+				if (cur[i] == NONE)
+					continue;
+				int s = slot(keys[first + i][depth]);
+				uint32_t child = s < 0 ? 0 : m_nodes[cur[i]].chn[s];
+				cur[i] = child == 0 ? NONE : child;
+				if (child != 0)
+				{
+					prefetch(&m_nodes[child]);   //needed on the next step
+					visited++;
 				}
 			}
-			else
+		}
+		for (size_t i = 0; i != n; i++)
+		{
+			if (cur[i] == NONE)
+				continue;
+			const Node& node = m_nodes[cur[i]];
+			found(first + i, m_vals.data() + node.valOffset, node.valCount);
+		}
+	}
+	return visited;
+}
+
+template<typename ValueType>
+template<typename Visit>
+size_t Trie<ValueType>::findHelper(uint32_t cur, const char* key, size_t keyLength, size_t depth,
+	bool exactMatchesOnly, Visit& visit) const
+{
+	const Node& node = m_nodes[cur];
+	if (depth == keyLength)
+	{
+		if (node.valCount != 0)
+			visit(m_vals.data() + node.valOffset, node.valCount);
+		return 1;
+	}
+	size_t visited = 1;
+	int s = slot(key[depth]);
+	for (int c = 0; c != ALPHABET; c++)
+	{
+		uint32_t child = node.chn[c];
+		if (child == 0)
+			continue;
+		if (c == s)
+			visited += findHelper(child, key, keyLength, depth + 1, exactMatchesOnly, visit);
+		else if (!exactMatchesOnly && depth != 0)    //the first base must always match
+			visited += findHelper(child, key, keyLength, depth + 1, true, visit);
+	}
+	return visited;
+}
+
+// Copies every key and value of other, which may view an index file, into
+// this trie; other is left as it was.  An empty trie just takes copies of
+// other's arrays, or views what they view.
+// A key's values from other go after the ones already here, so merging
+// tries built from consecutive batches gives the same trie as inserting
+// the batches in order.
+template<typename ValueType>
+void Trie<ValueType>::merge(const Trie& other)
+{
+	if (m_nodes.size() == 1 && m_vals.empty())
+	{
+		m_nodes = other.m_nodes;
+		m_vals = other.m_vals;
+		for (int i = 0; i != MAX_CLASSES; i++)
+			m_freeRanges[i] = other.m_freeRanges[i];
+		return;
+	}
+	std::vector<std::pair<uint32_t, uint32_t> > pending;     //(node here, node in other)
+	pending.push_back(std::make_pair(0u, 0u));
+	while (!pending.empty())
+	{
+		uint32_t dst = pending.back().first;
+		uint32_t src = pending.back().second;
+		pending.pop_back();
+		const Node& from = other.m_nodes[src];
+		if (from.valCount != 0)
+			appendValues(dst, &other.m_vals[from.valOffset], from.valCount);
+		for (int c = 0; c != ALPHABET; c++)
+		{
+			uint32_t srcChild = other.m_nodes[src].chn[c];
+			if (srcChild == 0)
+				continue;
+			uint32_t dstChild = m_nodes[dst].chn[c];
+			if (dstChild == 0)
 			{
-				if (key[0] != child->label)
-					b = true;
-				findHelper(child, key.substr(1), matches, b, true);
+				dstChild = (uint32_t)m_nodes.size();
+				m_nodes.push_back(Node());
+				m_nodes[dst].chn[c] = dstChild;
 			}
+			pending.push_back(std::make_pair(dstChild, srcChild));
 		}
-		b = exactMatchesOnly;
 	}
-	return matches;
 }
 
 template<typename ValueType>
-void Trie<ValueType>::deleteTree(Node * cur) //ASK ABOUT DELETE FUNC
+void Trie<ValueType>::swap(Trie& other)
 {
-	if (this == nullptr)
-		return;
-	typename std::list<Node*>::iterator nodeIt = cur->chn.begin();
-	for (; nodeIt != cur->chn.end(); )        //recurse over the children
+	std::swap(m_nodes, other.m_nodes);
+	std::swap(m_vals, other.m_vals);
+	for (int i = 0; i != MAX_CLASSES; i++)
+		m_freeRanges[i].swap(other.m_freeRanges[i]);
+}
+
+template<typename ValueType>
+bool Trie<ValueType>::fits(size_t keyCount, size_t keyLength)
+{
+	const uint64_t LIMIT = 0xFFFFFFFF;
+	if (keyCount > LIMIT / 4)
+		return false;
+	uint64_t nodes = 1;                   //the root, then at most min(5^d, keyCount) at depth d
+	uint64_t level = 1;
+	for (size_t d = 0; d != keyLength && nodes <= LIMIT; d++)
 	{
-		deleteTree(*nodeIt);
-		nodeIt = cur->chn.erase(nodeIt);
+		if (level < keyCount)
+			level *= ALPHABET;
+		nodes += level < keyCount ? level : keyCount;
 	}
+	return nodes <= LIMIT;
+}
+
+template<typename ValueType>
+void Trie<ValueType>::countMemory(MemoryTally& nodes, MemoryTally& values) const
+{
+	nodes.add(m_nodes);
+	for (int i = 0; i != MAX_CLASSES; i++)
+		nodes.add(m_freeRanges[i]);
+	values.add(m_vals);
+}
 
-	delete cur;
+template<typename ValueType>
+size_t Trie<ValueType>::allocations() const
+{
+	return m_nodes.allocations() + m_vals.allocations();
+}
+
+template<typename ValueType>
+template<typename Writer>
+void Trie<ValueType>::save(Writer& out) const
+{
+	out.array(m_nodes.data(), m_nodes.size());
+	out.array(m_vals.data(), m_vals.size());
+}
+
+template<typename ValueType>
+template<typename Reader>
+bool Trie<ValueType>::load(Reader& in)
+{
+	if (!in.array(m_nodes) || !in.array(m_vals) || m_nodes.empty())
+		return false;
+	for (int i = 0; i != MAX_CLASSES; i++)     //ranges freed before saving are simply lost
+		m_freeRanges[i].clear();
+	return true;
 }
 
 #endif // TRIE_INCLUDED
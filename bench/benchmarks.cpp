@@ -0,0 +1,882 @@
+// Performance benchmarks for the genome library.
+//
+// Build from this directory with, e.g.,
+//   g++ -std=c++17 -O2 -pthread -I.. -o benchmarks benchmarks.cpp ../Genome.cpp ../GenomeMatcher.cpp
+// and run "benchmarks <name>" (or no arguments to run all of them).
+
+#include "provided.h"
+#include "PackedSequence.h"
+#include "Trie.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+using namespace std;
+
+using Clock = chrono::steady_clock;
+
+double secondsSince(Clock::time_point start)
+{
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Resident set size of this process in MB, or -1 where it isn't available.
+double residentMB()
+{
+#if defined(__linux__)
+	ifstream statm("/proc/self/statm");
+	long pages, resident;
+	if (statm >> pages >> resident)
+		return resident * 4096.0 / (1 << 20);
+#endif
+	return -1;
+}
+
+string randomBases(mt19937& rng, int length)
+{
+	static const char bases[] = "ACGT";
+	string s(length, 'A');
+	for (char& c : s)
+		c = bases[rng() % 4];
+	return s;
+}
+
+// Query latency of findGenomesWithThisDNA as the number of genomes in the
+// library grows.  Every query is taken from genome 0, so the number of hits
+// per query stays the same and only the library size changes.
+void benchGenomeCount()
+{
+	const int minSearchLength = 16;
+	const int genomeLength = 1000;
+	const int queries = 2000;
+	cout << "genome_count: minSearchLength " << minSearchLength << ", genome length " << genomeLength << endl;
+	cout << setw(10) << "genomes" << setw(16) << "us/exact" << setw(16) << "us/snip" << endl;
+	for (int count : { 10, 100, 1000, 10000 })
+	{
+		mt19937 rng(42);
+		GenomeMatcher library(minSearchLength);
+		string first;
+		for (int g = 0; g != count; g++)
+		{
+			string dna = randomBases(rng, genomeLength);
+			if (g == 0)
+				first = dna;
+			library.addGenome(Genome("genome" + to_string(g), dna));
+		}
+		vector<string> fragments;
+		for (int q = 0; q != queries; q++)
+			fragments.push_back(first.substr(rng() % (genomeLength - 2 * minSearchLength), 2 * minSearchLength));
+
+		double perQuery[2];
+		for (int exact = 1; exact >= 0; exact--)
+		{
+			vector<DNAMatch> matches;
+			Clock::time_point start = Clock::now();
+			for (const string& f : fragments)
+			{
+				matches.clear();
+				library.findGenomesWithThisDNA(f, 2 * minSearchLength, exact != 0, matches);
+			}
+			perQuery[exact] = 1e6 * secondsSince(start) / queries;
+		}
+		cout << setw(10) << count << fixed << setprecision(2)
+			<< setw(16) << perQuery[1] << setw(16) << perQuery[0] << endl;
+	}
+}
+
+// Throughput of PackedSequence::matchLength, the match extension kernel,
+// in bases compared per second.  The two sequences differ every `spacing`
+// bases, so each call extends across one mismatch (SNiP mode) or stops at
+// it (exact mode).
+void benchExtension()
+{
+	const int length = 1 << 20;
+	const int spacing = 4096;
+	const int rounds = 50;
+	mt19937 rng(7);
+	string a = randomBases(rng, length);
+	string b = a;
+	for (int i = spacing - 1; i < length; i += spacing)
+		b[i] = (b[i] == 'A' ? 'C' : 'A');
+	PackedSequence pa(a), pb(b);
+
+	cout << "extension: " << length << " bases, a mismatch every " << spacing << " bases" << endl;
+	cout << setw(10) << "kernel" << setw(18) << "Mbases/s exact" << setw(18) << "Mbases/s snip" << endl;
+	const char* names[] = { "scalar", "word", "simd" };
+	PackedSequence::Kernel kernels[] = { PackedSequence::SCALAR_KERNEL, PackedSequence::WORD_KERNEL, PackedSequence::SIMD_KERNEL };
+	for (int k = 0; k != 3; k++)
+	{
+		double rate[2];
+		for (int allowed = 0; allowed != 2; allowed++)
+		{
+			long long bases = 0;
+			Clock::time_point start = Clock::now();
+			for (int r = 0; r != (k == 0 ? 1 : rounds); r++)
+			{
+				for (int pos = r % 64; pos < length - 2 * spacing; pos += spacing)
+					bases += PackedSequence::matchLength(pa, pos, pb, pos, 2 * spacing, allowed, kernels[k]);
+			}
+			rate[allowed] = bases / secondsSince(start) / 1e6;
+		}
+		cout << setw(10) << names[k] << fixed << setprecision(1) << setw(18) << rate[0] << setw(18) << rate[1] << endl;
+	}
+}
+
+const char* indexName(GenomeMatcher::IndexType type)
+{
+	switch (type)
+	{
+	case GenomeMatcher::FM_INDEX: return "fm";
+	case GenomeMatcher::HASH_INDEX: return "hash";
+	case GenomeMatcher::MINIMIZER_INDEX: return "minimizer";
+	default: return "trie";
+	}
+}
+
+bool sameMatches(const vector<DNAMatch>& a, const vector<DNAMatch>& b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i != a.size(); i++)
+	{
+		if (a[i].genomeName != b[i].genomeName || a[i].length != b[i].length || a[i].position != b[i].position)
+			return false;
+	}
+	return true;
+}
+
+// Indexing throughput of addGenome in a loop against addGenomes with 1 to
+// 2x the hardware threads, checking that every build answers a sample of
+// queries exactly like the serial one.
+void benchIndexBuild()
+{
+	const int minSearchLength = 10;
+	const int genomeCount = 40;
+	const int genomeLength = 100000;
+	mt19937 rng(11);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	vector<string> fragments;
+	for (int q = 0; q != 200; q++)
+	{
+		string f;
+		genomes[rng() % genomeCount].extract(rng() % (genomeLength - 40), 40, f);
+		fragments.push_back(f);
+	}
+	const double megabases = genomeCount * (double)genomeLength / 1e6;
+	cout << "index_build: " << genomeCount << " genomes of " << genomeLength << " bases, minSearchLength "
+		<< minSearchLength << endl;
+
+	GenomeMatcher serial(minSearchLength);
+	Clock::time_point start = Clock::now();
+	for (const Genome& g : genomes)
+		serial.addGenome(g);
+	cout << setw(12) << "addGenome" << fixed << setprecision(2) << setw(12) << megabases / secondsSince(start) << " Mbases/s" << endl;
+	vector<vector<DNAMatch> > expected(fragments.size());
+	for (size_t q = 0; q != fragments.size(); q++)
+		serial.findGenomesWithThisDNA(fragments[q], 20, false, expected[q]);
+
+	int maxThreads = 2 * max(1, (int)thread::hardware_concurrency());
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		GenomeMatcher bulk(minSearchLength);
+		start = Clock::now();
+		bulk.addGenomes(genomes, threads);
+		double rate = megabases / secondsSince(start);
+		bool same = true;
+		for (size_t q = 0; q != fragments.size(); q++)
+		{
+			vector<DNAMatch> matches;
+			bulk.findGenomesWithThisDNA(fragments[q], 20, false, matches);
+			same = same && sameMatches(matches, expected[q]);
+		}
+		cout << setw(9) << threads << " th" << setw(12) << rate << " Mbases/s"
+			<< (same ? "" : "  RESULTS DIFFER FROM SERIAL BUILD") << endl;
+	}
+}
+
+// The trie, FM-index and hash libraries head to head: build time, memory growth
+// and query latency for exact searches of several lengths, a SNiP search
+// and findRelatedGenomes.
+void benchFMIndex()
+{
+	const int minSearchLength = 10;
+	const int genomeCount = 20;
+	const int genomeLength = 200000;
+	mt19937 rng(5);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	string queryBases;
+	genomes[3].extract(1000, 20000, queryBases);
+	Genome query("query", queryBases);
+	cout << "fm_index: " << genomeCount << " genomes of " << genomeLength << " bases, minSearchLength "
+		<< minSearchLength << endl;
+	cout << setw(8) << "index" << setw(10) << "build s" << setw(10) << "MB" << setw(12) << "us/ex20"
+		<< setw(12) << "us/ex100" << setw(12) << "us/ex1000" << setw(12) << "us/snip20" << setw(12) << "ms/related" << endl;
+
+	const GenomeMatcher::IndexType types[] = { GenomeMatcher::TRIE_INDEX, GenomeMatcher::FM_INDEX, GenomeMatcher::HASH_INDEX };
+	for (GenomeMatcher::IndexType type : types)
+	{
+		double before = residentMB();
+		Clock::time_point start = Clock::now();
+		GenomeMatcher library(minSearchLength, type);
+		library.addGenomes(genomes, 1);
+		vector<DNAMatch> matches;
+		double buildSeconds = secondsSince(start);
+		double mb = residentMB() - before;
+
+		cout << setw(8) << indexName(type) << fixed << setprecision(2)
+			<< setw(10) << buildSeconds << setw(10) << mb;
+		const int lengths[] = { 20, 100, 1000, 20 };
+		for (int i = 0; i != 4; i++)
+		{
+			const int queries = 500;
+			start = Clock::now();
+			for (int q = 0; q != queries; q++)
+			{
+				string f = queryBases.substr(rng() % (queryBases.size() - lengths[i]), lengths[i]);
+				matches.clear();
+				library.findGenomesWithThisDNA(f, lengths[i], i != 3, matches);
+			}
+			cout << setw(12) << 1e6 * secondsSince(start) / queries;
+		}
+		vector<GenomeMatch> related;
+		start = Clock::now();
+		library.findRelatedGenomes(query, 2 * minSearchLength, true, 10, related);
+		cout << setw(12) << 1e3 * secondsSince(start) << endl;
+	}
+}
+
+// Memory, pool allocations and teardown time of a trie holding every
+// k-mer of a few megabases, released by reset and by destruction.
+void benchTrieMemory()
+{
+	const int keyLength = 12;
+	const int length = 4000000;
+	mt19937 rng(29);
+	string bases = randomBases(rng, length);
+	cout << "trie_memory: " << length - keyLength + 1 << " keys of " << keyLength << " bases" << endl;
+	cout << setw(10) << "release" << setw(12) << "insert s" << setw(10) << "MB" << setw(14) << "allocations"
+		<< setw(12) << "free ms" << endl;
+	for (int pass = 0; pass != 2; pass++)
+	{
+		Trie<uint32_t>* trie = new Trie<uint32_t>;
+		Clock::time_point start = Clock::now();
+		string key;
+		for (int i = 0; i + keyLength <= length; i++)
+		{
+			key.assign(bases, i, keyLength);
+			trie->insert(key, i);
+		}
+		double insertSeconds = secondsSince(start);
+		MemoryTally nodes, values;
+		trie->countMemory(nodes, values);
+		double mb = (nodes.bytes + values.bytes) / double(1 << 20);
+		size_t allocations = trie->allocations();
+		start = Clock::now();
+		if (pass == 0)
+			trie->reset();
+		delete trie;
+		cout << setw(10) << (pass == 0 ? "reset" : "delete") << fixed << setprecision(2) << setw(12) << insertSeconds
+			<< setw(10) << mb << setw(14) << allocations << setw(12) << 1e3 * secondsSince(start) << endl;
+	}
+}
+
+// Memory against search time of the minimizer-sampled index, next to the
+// full trie and hash indexes, for two minimum search lengths, checking that
+// every index finds what the trie does.
+void benchMinimizer()
+{
+	const int genomeCount = 20;
+	const int genomeLength = 200000;
+	mt19937 rng(31);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	cout << "minimizer: " << genomeCount << " genomes of " << genomeLength << " bases" << endl;
+	cout << setw(6) << "k" << setw(12) << "index" << setw(10) << "build s" << setw(10) << "MB"
+		<< setw(12) << "us/exact" << setw(12) << "us/snip" << setw(12) << "us/snip2k" << endl;
+
+	for (int minSearchLength : { 20, 32 })
+	{
+		const int queries = 1000;
+		vector<string> fragments;
+		for (int q = 0; q != queries; q++)         //taken from a genome, some with a SNiP
+		{
+			string f;
+			genomes[rng() % genomeCount].extract(rng() % (genomeLength - 2 * minSearchLength), 2 * minSearchLength, f);
+			if (q % 2 == 0)
+				f[1 + rng() % (f.size() - 1)] = "ACGT"[rng() % 4];
+			fragments.push_back(f);
+		}
+		vector<vector<DNAMatch> > expected[3];     //exact, snip, snip of 2k
+		const GenomeMatcher::IndexType types[] = { GenomeMatcher::TRIE_INDEX, GenomeMatcher::HASH_INDEX,
+			GenomeMatcher::MINIMIZER_INDEX };
+		for (GenomeMatcher::IndexType type : types)
+		{
+			double before = residentMB();
+			Clock::time_point start = Clock::now();
+			GenomeMatcher library(minSearchLength, type);
+			library.addGenomes(genomes, 1);
+			double buildSeconds = secondsSince(start);
+			double mb = residentMB() - before;
+			cout << setw(6) << minSearchLength << setw(12) << indexName(type) << fixed << setprecision(2)
+				<< setw(10) << buildSeconds << setw(10) << mb;
+			bool same = true;
+			for (int mode = 0; mode != 3; mode++)
+			{
+				const int length = mode == 2 ? 2 * minSearchLength : minSearchLength;
+				vector<vector<DNAMatch> > found(queries);
+				start = Clock::now();
+				for (int q = 0; q != queries; q++)
+					library.findGenomesWithThisDNA(fragments[q], length, mode == 0, found[q]);
+				cout << setw(12) << 1e6 * secondsSince(start) / queries;
+				if (type == GenomeMatcher::TRIE_INDEX)
+					expected[mode] = found;
+				for (int q = 0; q != queries; q++)
+					same = same && sameMatches(found[q], expected[mode][q]);
+			}
+			cout << (same ? "" : "  RESULTS DIFFER FROM TRIE") << endl;
+		}
+	}
+}
+
+// findRelatedGenomes with and without the sketch prefilter on a library
+// where only a few genomes share anything with the query, reporting the
+// prefilter's recall: the share of the genomes found without it that it
+// still finds.
+void benchPrefilter()
+{
+	const int minSearchLength = 10;
+	const int genomeCount = 400;
+	const int genomeLength = 50000;
+	const int related = 8;
+	mt19937 rng(37);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	string queryBases;
+	for (int g = 0; g != related; g++)           //genome g makes up a growing share of the query
+	{
+		string piece;
+		genomes[g * 7].extract(0, 2000 * (g + 1), piece);
+		for (int m = 0; m != (int)piece.size() / 500; m++)      //with a SNiP every 500 bases
+			piece[rng() % piece.size()] = "ACGT"[rng() % 4];
+		queryBases += piece + randomBases(rng, 2000);
+	}
+	Genome query("query", queryBases);
+	GenomeMatcher library(minSearchLength);
+	library.addGenomes(genomes);
+	cout << "prefilter: query of " << queryBases.size() << " bases, " << genomeCount << " genomes of "
+		<< genomeLength << " bases, " << related << " related" << endl;
+	cout << setw(8) << "mode" << setw(10) << "percent" << setw(12) << "full ms" << setw(12) << "filter ms"
+		<< setw(10) << "found" << setw(10) << "recall" << endl;
+
+	const int fragmentLength = 30;
+	for (bool exact : { true, false })
+	{
+		for (double percent : { 1.0, 5.0, 10.0, 20.0 })
+		{
+			vector<GenomeMatch> full, filtered;
+			Clock::time_point start = Clock::now();
+			library.findRelatedGenomes(query, fragmentLength, exact, percent, full, 1);
+			double fullSeconds = secondsSince(start);
+			start = Clock::now();
+			library.findRelatedGenomes(query, fragmentLength, exact, percent, filtered, 1, true);
+			double filterSeconds = secondsSince(start);
+			size_t kept = 0;
+			bool same = true;                    //the genomes it keeps get the same percentages
+			for (const GenomeMatch& f : filtered)
+			{
+				auto it = find_if(full.begin(), full.end(), [&f](const GenomeMatch& m) { return m.genomeName == f.genomeName; });
+				if (it != full.end() && it->percentMatch == f.percentMatch)
+					kept++;
+				else
+					same = false;
+			}
+			cout << setw(8) << (exact ? "exact" : "snip") << fixed << setprecision(1) << setw(10) << percent
+				<< setw(12) << 1e3 * fullSeconds << setw(12) << 1e3 * filterSeconds << setw(10) << full.size()
+				<< setprecision(2) << setw(10) << (full.empty() ? 1.0 : kept / (double)full.size())
+				<< (same ? "" : "  PERCENTAGES DIFFER") << endl;
+		}
+	}
+}
+
+// findRelatedGenomes on a batch of near-identical strains, as
+// findRelatedGenomesFromFile would run them, with and without the query
+// cache, checking that the cache changes none of the results.
+void benchQueryCache()
+{
+	const int minSearchLength = 12;
+	const int genomeCount = 200;
+	const int genomeLength = 50000;
+	const int strains = 8;
+	mt19937 rng(53);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	string ancestor;
+	genomes[0].extract(0, 40000, ancestor);
+	vector<Genome> queries;
+	for (int q = 0; q != strains; q++)           //each strain has a SNiP every 1000 bases or so
+	{
+		string strain = ancestor;
+		for (int m = 0; m != (int)strain.size() / 1000; m++)
+			strain[rng() % strain.size()] = "ACGT"[rng() % 4];
+		queries.push_back(Genome("strain" + to_string(q), strain));
+	}
+	GenomeMatcher library(minSearchLength);
+	library.addGenomes(genomes);
+	cout << "query_cache: " << strains << " strains of " << ancestor.size() << " bases, " << genomeCount
+		<< " genomes of " << genomeLength << " bases" << endl;
+	cout << setw(8) << "mode" << setw(12) << "off ms" << setw(12) << "on ms" << setw(12) << "hit rate" << endl;
+	for (bool exact : { true, false })
+	{
+		vector<vector<GenomeMatch> > expected(strains), results(strains);
+		library.setQueryCacheSize(0);
+		Clock::time_point start = Clock::now();
+		for (int q = 0; q != strains; q++)
+			library.findRelatedGenomes(queries[q], 2 * minSearchLength, exact, 1, expected[q], 1);
+		double offSeconds = secondsSince(start);
+		library.setQueryCacheSize(1 << 16);
+		QueryCacheStats before = library.queryCacheStats();
+		start = Clock::now();
+		for (int q = 0; q != strains; q++)
+			library.findRelatedGenomes(queries[q], 2 * minSearchLength, exact, 1, results[q], 1);
+		double onSeconds = secondsSince(start);
+		QueryCacheStats after = library.queryCacheStats();
+		size_t hits = after.hits - before.hits;
+		size_t lookups = hits + after.misses - before.misses;
+		bool same = true;
+		for (int q = 0; q != strains; q++)
+		{
+			same = same && results[q].size() == expected[q].size();
+			for (size_t i = 0; same && i != results[q].size(); i++)
+				same = results[q][i].genomeName == expected[q][i].genomeName && results[q][i].percentMatch == expected[q][i].percentMatch;
+		}
+		cout << setw(8) << (exact ? "exact" : "snip") << fixed << setprecision(1) << setw(12) << 1e3 * offSeconds
+			<< setw(12) << 1e3 * onSeconds << setprecision(2) << setw(12) << hits / (double)lookups
+			<< (same ? "" : "  RESULTS DIFFER") << endl;
+	}
+}
+
+// Queries per second of findGenomesWithThisDNA one fragment at a time
+// against the batch overload, checking that the batch finds the same
+// matches for every fragment.
+void benchBatch()
+{
+	const int minSearchLength = 12;
+	const int genomeCount = 20;
+	const int genomeLength = 200000;
+	const int queries = 20000;
+	mt19937 rng(23);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	GenomeMatcher library(minSearchLength);
+	library.addGenomes(genomes);
+	cout << "batch: " << queries << " queries, " << genomeCount << " genomes of " << genomeLength
+		<< " bases, minSearchLength " << minSearchLength << endl;
+	cout << setw(8) << "mode" << setw(14) << "single q/s" << setw(14) << "batch q/s" << setw(10) << "speedup" << endl;
+
+	for (bool exact : { true, false })
+	{
+		const int length = 2 * minSearchLength;
+		vector<string> fragments;
+		for (int q = 0; q != queries; q++)           //half of them taken from a genome, half random
+		{
+			string f;
+			if (q % 2 == 0)
+				genomes[rng() % genomeCount].extract(rng() % (genomeLength - length), length, f);
+			else
+				f = randomBases(rng, length);
+			fragments.push_back(f);
+		}
+
+		vector<vector<DNAMatch> > single(queries);
+		Clock::time_point start = Clock::now();
+		for (int q = 0; q != queries; q++)
+			library.findGenomesWithThisDNA(fragments[q], length, exact, single[q]);
+		double singleSeconds = secondsSince(start);
+
+		vector<DNAMatch> matches;
+		vector<int> offsets;
+		start = Clock::now();
+		library.findGenomesWithThisDNA(fragments, length, exact, matches, offsets);
+		double batchSeconds = secondsSince(start);
+
+		bool same = offsets.size() == fragments.size() + 1;
+		for (int q = 0; same && q != queries; q++)
+		{
+			vector<DNAMatch> batch(matches.begin() + offsets[q], matches.begin() + offsets[q + 1]);
+			same = sameMatches(batch, single[q]);
+		}
+		cout << setw(8) << (exact ? "exact" : "snip") << fixed << setprecision(0)
+			<< setw(14) << queries / singleSeconds << setw(14) << queries / batchSeconds << setprecision(2)
+			<< setw(10) << singleSeconds / batchSeconds << (same ? "" : "  RESULTS DIFFER") << endl;
+	}
+}
+
+// findRelatedGenomes on a whole-genome query with 1 to 2x the hardware
+// threads, checking that every run gives the single-threaded results.
+void benchRelated()
+{
+	const int minSearchLength = 12;
+	const int genomeCount = 20;
+	const int genomeLength = 200000;
+	mt19937 rng(17);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	string queryBases;
+	for (int g = 0; g != 4; g++)                 //a query that shares a piece with a few genomes
+	{
+		string piece;
+		genomes[g].extract(0, genomeLength / 4, piece);
+		queryBases += piece + randomBases(rng, genomeLength / 4);
+	}
+	Genome query("query", queryBases);
+	GenomeMatcher library(minSearchLength);
+	library.addGenomes(genomes);
+	cout << "related: query of " << queryBases.size() << " bases, " << genomeCount << " genomes of "
+		<< genomeLength << " bases" << endl;
+
+	vector<GenomeMatch> expected[2];             //exact, snip
+	int maxThreads = 2 * max(1, (int)thread::hardware_concurrency());
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		for (bool exact : { true, false })
+		{
+			vector<GenomeMatch> results;
+			Clock::time_point start = Clock::now();
+			library.findRelatedGenomes(query, 2 * minSearchLength, exact, 1, results, threads);
+			double seconds = secondsSince(start);
+			vector<GenomeMatch>& serial = expected[exact ? 0 : 1];
+			if (threads == 1)
+				serial = results;
+			bool same = results.size() == serial.size();
+			for (size_t i = 0; same && i != results.size(); i++)
+				same = results[i].genomeName == serial[i].genomeName && results[i].percentMatch == serial[i].percentMatch;
+			cout << setw(9) << threads << " th" << setw(8) << (exact ? "exact" : "snip") << fixed << setprecision(1)
+				<< setw(12) << 1e3 * seconds << " ms" << (same ? "" : "  RESULTS DIFFER FROM ONE THREAD") << endl;
+		}
+	}
+}
+
+// Queries per second of 1 to hardware-threads readers calling
+// findGenomesWithThisDNA for a fixed time, alone and while another thread
+// adds genomes one at a time, checking that every query finds the genome
+// it was taken from.  Readers search a published version of the library
+// and never wait for the writer, so only sharing the cores should slow
+// them down.
+void benchIngest()
+{
+	const int minSearchLength = 12;
+	const int genomeCount = 20;
+	const int genomeLength = 200000;
+	const int addedLength = 50000;
+	const double seconds = 1;
+	mt19937 rng(61);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	vector<Genome> added;
+	for (int g = 0; g != 200; g++)
+		added.push_back(Genome("added" + to_string(g), randomBases(rng, addedLength)));
+	cout << "ingest: " << genomeCount << " genomes of " << genomeLength << " bases, writer adding genomes of "
+		<< addedLength << " bases" << endl;
+	cout << setw(8) << "readers" << setw(14) << "alone q/s" << setw(14) << "writing q/s" << setw(10) << "ratio"
+		<< setw(10) << "added" << endl;
+
+	int maxReaders = max(1, (int)thread::hardware_concurrency());
+	for (int readers = 1; readers <= maxReaders; readers *= 2)
+	{
+		double rates[2];
+		int addedCount = 0;
+		bool allFound = true;
+		for (int writing = 0; writing != 2; writing++)
+		{
+			GenomeMatcher library(minSearchLength);
+			library.addGenomes(genomes);
+			atomic<bool> stop(false);
+			atomic<long> queries(0);
+			atomic<bool> found(true);
+			vector<thread> threads;
+			for (int r = 0; r != readers; r++)
+			{
+				threads.push_back(thread([&, r]() {
+					mt19937 readerRng(r);
+					string fragment;
+					vector<DNAMatch> matches;
+					long count = 0;
+					while (!stop)
+					{
+						int g = readerRng() % genomeCount;
+						genomes[g].extract(readerRng() % (genomeLength - 2 * minSearchLength), 2 * minSearchLength, fragment);
+						matches.clear();
+						library.findGenomesWithThisDNA(fragment, 2 * minSearchLength, true, matches);
+						if (find_if(matches.begin(), matches.end(), [&](const DNAMatch& m) {
+								return m.genomeName == genomes[g].name(); }) == matches.end())
+							found = false;
+						count++;
+					}
+					queries += count;
+				}));
+			}
+			if (writing)
+			{
+				threads.push_back(thread([&]() {
+					for (size_t g = 0; g != added.size() && !stop; g++, addedCount++)
+						library.addGenome(added[g]);
+				}));
+			}
+			this_thread::sleep_for(chrono::duration<double>(seconds));
+			stop = true;
+			for (thread& t : threads)
+				t.join();
+			rates[writing] = queries / seconds;
+			allFound = allFound && found;
+		}
+		cout << setw(8) << readers << fixed << setprecision(0) << setw(14) << rates[0] << setw(14) << rates[1]
+			<< setprecision(2) << setw(10) << rates[1] / rates[0] << setw(10) << addedCount
+			<< (allFound ? "" : "  QUERIES MISSED THEIR GENOME") << endl;
+	}
+}
+
+// Each index type built by addGenome in a loop, which leaves the library in
+// several segments, against one addGenomes call, which makes one: the time
+// to add the genomes and the latency of SNiP and exact searches of 40
+// bases, checking that both libraries find the same matches.
+void benchSerialAdd()
+{
+	const int minSearchLength = 12;
+	const int genomeCount = 300;
+	const int genomeLength = 20000;
+	mt19937 rng(67);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	vector<string> fragments;
+	for (int q = 0; q != 300; q++)
+	{
+		string f;
+		genomes[rng() % genomeCount].extract(rng() % (genomeLength - 40), 40, f);
+		f[20] = f[20] == 'A' ? 'C' : 'A';
+		fragments.push_back(f);
+	}
+	cout << "serial_add: " << genomeCount << " genomes of " << genomeLength << " bases, minSearchLength "
+		<< minSearchLength << endl;
+	cout << setw(10) << "index" << setw(10) << "added by" << setw(10) << "add s" << setw(12) << "us/snip40"
+		<< setw(12) << "us/ex40" << endl;
+
+	const GenomeMatcher::IndexType types[] = { GenomeMatcher::TRIE_INDEX, GenomeMatcher::FM_INDEX,
+		GenomeMatcher::HASH_INDEX, GenomeMatcher::MINIMIZER_INDEX };
+	for (GenomeMatcher::IndexType type : types)
+	{
+		vector<vector<DNAMatch> > expected(fragments.size());
+		for (int serial = 1; serial >= 0; serial--)
+		{
+			GenomeMatcher library(minSearchLength, type);
+			Clock::time_point start = Clock::now();
+			if (serial)
+			{
+				for (const Genome& g : genomes)
+					library.addGenome(g);
+			}
+			else
+				library.addGenomes(genomes, 1);
+			cout << setw(10) << indexName(type) << setw(10) << (serial ? "genome" : "batch") << fixed
+				<< setprecision(2) << setw(10) << secondsSince(start);
+			bool same = true;
+			for (int exact = 0; exact != 2; exact++)
+			{
+				start = Clock::now();
+				for (size_t q = 0; q != fragments.size(); q++)
+				{
+					vector<DNAMatch> matches;
+					library.findGenomesWithThisDNA(fragments[q], 30, exact != 0, matches);
+					if (serial && !exact)
+						expected[q] = matches;
+					else if (!exact)
+						same = same && sameMatches(matches, expected[q]);
+				}
+				cout << setw(12) << setprecision(1) << 1e6 * secondsSince(start) / fragments.size();
+			}
+			cout << (same ? "" : "  RESULTS DIFFER FROM ADDGENOME") << endl;
+		}
+	}
+}
+
+// Genome::load throughput on a FASTA file of 80-base lines, next to the
+// rate at which the same file can be read into memory at all.
+void benchParse()
+{
+	const int recordCount = 8;
+	const int recordLength = 8 << 20;
+	const string path = "benchmarks.fa";
+	mt19937 rng(13);
+	{
+		ofstream out(path.c_str(), ios::binary);
+		for (int r = 0; r != recordCount; r++)
+		{
+			string bases = randomBases(rng, recordLength);
+			for (int i = 0; i < recordLength; i += 1000)      //some lower case and N runs
+			{
+				bases[i] = 'N';
+				bases[i + 1] = 'a';
+			}
+			out << ">record " << r << "\n";
+			for (int i = 0; i < recordLength; i += 80)
+				out << bases.substr(i, 80) << "\n";
+		}
+	}
+	ifstream sizer(path.c_str(), ios::binary | ios::ate);
+	const double megabytes = (double)sizer.tellg() / (1 << 20);
+	cout << "parse: " << recordCount << " records of " << recordLength << " bases, " << fixed << setprecision(1)
+		<< megabytes << " MB" << endl;
+
+	const int reps = 3;
+	double readSeconds = 1e9;
+	double parseSeconds = 1e9;
+	bool ok = true;
+	for (int rep = 0; rep != reps; rep++)
+	{
+		Clock::time_point start = Clock::now();
+		ifstream raw(path.c_str(), ios::binary);
+		vector<char> buffer(1 << 20);
+		while (raw.read(&buffer[0], buffer.size()) || raw.gcount() > 0)
+			;
+		readSeconds = min(readSeconds, secondsSince(start));
+
+		start = Clock::now();
+		ifstream in(path.c_str());
+		vector<Genome> genomes;
+		ok = Genome::load(in, genomes) && genomes.size() == recordCount && genomes.back().length() == recordLength;
+		parseSeconds = min(parseSeconds, secondsSince(start));
+	}
+	cout << setw(12) << "read" << setw(12) << megabytes / readSeconds << " MB/s" << endl;
+	cout << setw(12) << "load" << setw(12) << megabytes / parseSeconds << " MB/s" << (ok ? "" : "  PARSE FAILED") << endl;
+	remove(path.c_str());
+}
+
+// Time to get a library ready for queries: building it from genomes versus
+// opening a saved index file, and query latency on the mapped index.
+void benchIndexFile()
+{
+	const int minSearchLength = 10;
+	const int genomeCount = 20;
+	const int genomeLength = 200000;
+	const string path = "benchmarks.idx";
+	mt19937 rng(9);
+	vector<Genome> genomes;
+	for (int g = 0; g != genomeCount; g++)
+		genomes.push_back(Genome("genome" + to_string(g), randomBases(rng, genomeLength)));
+	cout << "index_file: " << genomeCount << " genomes of " << genomeLength << " bases, minSearchLength "
+		<< minSearchLength << endl;
+	cout << setw(8) << "index" << setw(10) << "build s" << setw(10) << "save s" << setw(10) << "open ms"
+		<< setw(12) << "verify ms" << setw(12) << "us/ex20" << setw(12) << "us/mapped" << endl;
+
+	const GenomeMatcher::IndexType types[] = { GenomeMatcher::TRIE_INDEX, GenomeMatcher::FM_INDEX, GenomeMatcher::HASH_INDEX };
+	for (GenomeMatcher::IndexType type : types)
+	{
+		Clock::time_point start = Clock::now();
+		GenomeMatcher built(minSearchLength, type);
+		built.addGenomes(genomes, 1);
+		vector<DNAMatch> matches;
+		double buildSeconds = secondsSince(start);
+		start = Clock::now();
+		built.save(path);
+		double saveSeconds = secondsSince(start);
+
+		GenomeMatcher opened(minSearchLength);
+		start = Clock::now();
+		bool ok = opened.open(path);
+		double openSeconds = secondsSince(start);
+		GenomeMatcher verified(minSearchLength);
+		start = Clock::now();
+		ok = verified.open(path, true) && ok;
+		double verifySeconds = secondsSince(start);
+		if (!ok)
+		{
+			cout << "could not open " << path << endl;
+			return;
+		}
+
+		const int queries = 2000;
+		vector<string> fragments;
+		for (int q = 0; q != queries; q++)
+		{
+			const Genome& g = genomes[rng() % genomeCount];
+			string f;
+			g.extract(rng() % (genomeLength - 20), 20, f);
+			fragments.push_back(f);
+		}
+		double seconds[2];
+		GenomeMatcher* libraries[2] = { &built, &opened };
+		for (int i = 0; i != 2; i++)
+		{
+			start = Clock::now();
+			for (const string& f : fragments)
+			{
+				matches.clear();
+				libraries[i]->findGenomesWithThisDNA(f, 20, true, matches);
+			}
+			seconds[i] = secondsSince(start);
+		}
+		cout << setw(8) << indexName(type) << fixed << setprecision(2)
+			<< setw(10) << buildSeconds << setw(10) << saveSeconds << setw(10) << 1e3 * openSeconds
+			<< setw(12) << 1e3 * verifySeconds << setw(12) << 1e6 * seconds[0] / queries
+			<< setw(12) << 1e6 * seconds[1] / queries << endl;
+	}
+	remove(path.c_str());
+}
+
+struct Benchmark
+{
+	const char* name;
+	void (*run)();
+};
+
+const Benchmark benchmarks[] = {
+	{ "genome_count", benchGenomeCount },
+	{ "extension", benchExtension },
+	{ "index_build", benchIndexBuild },
+	{ "fm_index", benchFMIndex },
+	{ "index_file", benchIndexFile },
+	{ "parse", benchParse },
+	{ "related", benchRelated },
+	{ "batch", benchBatch },
+	{ "trie_memory", benchTrieMemory },
+	{ "minimizer", benchMinimizer },
+	{ "prefilter", benchPrefilter },
+	{ "query_cache", benchQueryCache },
+	{ "ingest", benchIngest },
+	{ "serial_add", benchSerialAdd },
+};
+
+int main(int argc, char* argv[])
+{
+	bool ranAny = false;
+	for (const Benchmark& b : benchmarks)
+	{
+		if (argc > 1 && strcmp(argv[1], b.name) != 0)
+			continue;
+		b.run();
+		ranAny = true;
+	}
+	if (!ranAny)
+	{
+		cerr << "Unknown benchmark " << argv[1] << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,311 @@
+// A reproducible benchmark of every stage of the library on synthetic data,
+// reported as JSON so runs can be compared to catch regressions.  The
+// genomes and queries come from a seeded generator, so the same options
+// give the same data on every machine.
+//
+// Build from this directory with, e.g.,
+//   g++ -std=c++17 -O2 -pthread -I.. -o suite suite.cpp ../Genome.cpp ../GenomeMatcher.cpp
+// and run
+//   suite [--option=value]... > results.json
+// Memory is in bytes, as GenomeMatcher::memoryUsage counts it once the
+// index is built.  Options (defaults in parentheses):
+//   --seed            generator seed (1)
+//   --genomes         number of genomes (100)
+//   --length          bases per genome (100000)
+//   --repeats         share of each genome made of copies of shared repeat
+//                     elements, 0 to 1 (0.1)
+//   --snp-rate        chance that a query base differs from its source (0.001)
+//   --queries         fragments searched by each findGenomesWithThisDNA mode (5000)
+//   --related         strain queries for findRelatedGenomes (4)
+//   --min-length      minSearchLength (16)
+//   --index           trie, fm, hash or minimizer (trie)
+//   --threads         threads for findRelatedGenomes, 0 for all (1)
+// Progress goes to standard error.
+
+#include "provided.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+using namespace std;
+
+using Clock = chrono::steady_clock;
+
+double secondsSince(Clock::time_point start)
+{
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Options
+{
+	unsigned seed = 1;
+	int genomes = 100;
+	int length = 100000;
+	double repeats = 0.1;
+	double snpRate = 0.001;
+	int queries = 5000;
+	int related = 4;
+	int minLength = 16;
+	GenomeMatcher::IndexType index = GenomeMatcher::TRIE_INDEX;
+	int threads = 1;
+};
+
+const char* indexNames[] = { "trie", "fm", "hash", "minimizer" };
+
+bool parseOptions(int argc, char* argv[], Options& options)
+{
+	for (int i = 1; i != argc; i++)
+	{
+		const char* eq = strchr(argv[i], '=');
+		if (strncmp(argv[i], "--", 2) != 0 || eq == nullptr)
+			return false;
+		string name(argv[i] + 2, eq - argv[i] - 2);
+		const char* value = eq + 1;
+		if (name == "seed")
+			options.seed = (unsigned)strtoul(value, nullptr, 10);
+		else if (name == "genomes")
+			options.genomes = atoi(value);
+		else if (name == "length")
+			options.length = atoi(value);
+		else if (name == "repeats")
+			options.repeats = atof(value);
+		else if (name == "snp-rate")
+			options.snpRate = atof(value);
+		else if (name == "queries")
+			options.queries = atoi(value);
+		else if (name == "related")
+			options.related = atoi(value);
+		else if (name == "min-length")
+			options.minLength = atoi(value);
+		else if (name == "threads")
+			options.threads = atoi(value);
+		else if (name == "index")
+		{
+			int type = 0;
+			while (type != 4 && strcmp(value, indexNames[type]) != 0)
+				type++;
+			if (type == 4)
+				return false;
+			options.index = (GenomeMatcher::IndexType)type;
+		}
+		else
+			return false;
+	}
+	return options.genomes > 0 && options.length >= 4 * options.minLength && options.minLength > 0
+		&& options.repeats >= 0 && options.repeats <= 1 && options.snpRate >= 0 && options.snpRate <= 1
+		&& options.queries > 0 && options.related >= 0 && options.threads >= 0;
+}
+
+// Makes genomes of random bases in which about a repeats share of the bases
+// are copies of a few shared repeat elements, each copy with 2% of its bases
+// changed, as transposons and other repeats appear in real genomes.  Query
+// fragments and strains are copies of parts of the genomes with each base
+// changed with probability snpRate.
+class SyntheticGenomes
+{
+public:
+	SyntheticGenomes(unsigned seed);
+	string genome(int length, double repeats);
+	string mutate(const string& bases, double rate);
+	int below(int n);
+private:
+	static const int REPEAT_FAMILIES = 20;
+	static const int REPEAT_LENGTH = 300;
+	mt19937_64 m_rng;
+	vector<string> m_repeats;
+	string randomBases(int length);
+};
+
+SyntheticGenomes::SyntheticGenomes(unsigned seed)
+	:m_rng(seed)
+{
+	for (int r = 0; r != REPEAT_FAMILIES; r++)
+		m_repeats.push_back(randomBases(REPEAT_LENGTH));
+}
+
+string SyntheticGenomes::randomBases(int length)
+{
+	static const char bases[] = "ACGT";
+	string s(length, 'A');
+	for (char& c : s)
+		c = bases[m_rng() % 4];
+	return s;
+}
+
+int SyntheticGenomes::below(int n)
+{
+	return (int)(m_rng() % n);
+}
+
+string SyntheticGenomes::genome(int length, double repeats)
+{
+	string s = randomBases(length);
+	int copies = (int)(repeats * length / REPEAT_LENGTH);
+	for (int c = 0; c != copies && length > REPEAT_LENGTH; c++)
+	{
+		string copy = mutate(m_repeats[below(REPEAT_FAMILIES)], 0.02);
+		s.replace(below(length - REPEAT_LENGTH), REPEAT_LENGTH, copy);
+	}
+	return s;
+}
+
+string SyntheticGenomes::mutate(const string& bases, double rate)
+{
+	static const char acgt[] = "ACGT";
+	static const char others[4][3] = { { 'C', 'G', 'T' }, { 'A', 'G', 'T' }, { 'A', 'C', 'T' }, { 'A', 'C', 'G' } };
+	string s = bases;
+	if (rate <= 0)
+		return s;
+	  //a draw for every base, compared as an integer: the standard
+	  //distributions differ from library to library, which would change the
+	  //data
+	const uint64_t threshold = rate >= 1 ? ~0ULL : (uint64_t)(rate * 18446744073709551616.0);    //rate * 2^64
+	for (char& base : s)
+	{
+		if (m_rng() >= threshold)
+			continue;
+		const char* c = strchr(acgt, base);
+		if (c != nullptr && *c != '\0')
+			base = others[c - acgt][m_rng() % 3];
+	}
+	return s;
+}
+
+// Latency summary of a set of timings, in microseconds.
+string latencyJSON(vector<double> micros)
+{
+	sort(micros.begin(), micros.end());
+	auto percentile = [&micros](double p) {
+		size_t rank = (size_t)ceil(p * micros.size());    //nearest rank
+		return micros[rank == 0 ? 0 : rank - 1];
+	};
+	double total = 0;
+	for (double m : micros)
+		total += m;
+	ostringstream out;
+	out << fixed << setprecision(2) << "{ \"mean_us\": " << total / micros.size() << ", \"p50_us\": " << percentile(0.5)
+		<< ", \"p90_us\": " << percentile(0.9) << ", \"p99_us\": " << percentile(0.99) << ", \"max_us\": " << micros.back() << " }";
+	return out.str();
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		cerr << "usage: suite [--seed=N] [--genomes=N] [--length=N] [--repeats=F] [--snp-rate=F] [--queries=N]" << endl;
+		cerr << "             [--related=N] [--min-length=N] [--index=trie|fm|hash|minimizer] [--threads=N]" << endl;
+		return 1;
+	}
+	SyntheticGenomes generator(options.seed);
+
+	cerr << "generating " << options.genomes << " genomes of " << options.length << " bases" << endl;
+	ostringstream fasta;
+	for (int g = 0; g != options.genomes; g++)
+	{
+		string bases = generator.genome(options.length, options.repeats);
+		fasta << ">genome" << g << "\n";
+		for (int i = 0; i < options.length; i += 80)
+			fasta << bases.substr(i, 80) << "\n";
+	}
+	const string fastaText = fasta.str();
+
+	cerr << "loading" << endl;
+	Clock::time_point start = Clock::now();
+	istringstream fastaIn(fastaText);
+	vector<Genome> genomes;
+	if (!Genome::load(fastaIn, genomes) || (int)genomes.size() != options.genomes)
+	{
+		cerr << "the generated genomes didn't load" << endl;
+		return 1;
+	}
+	const double loadSeconds = secondsSince(start);
+
+	cerr << "adding" << endl;
+	GenomeMatcher library(options.minLength, options.index);
+	start = Clock::now();
+	for (const Genome& g : genomes)
+		library.addGenome(g);
+	const double addSeconds = secondsSince(start);
+	const MemoryUsage memory = library.memoryUsage();
+
+	  //fragments of twice the minimum length, mutated; a few random ones
+	  //that are most likely nowhere in the library
+	const int fragmentLength = 2 * options.minLength;
+	vector<string> fragments;
+	for (int q = 0; q != options.queries; q++)
+	{
+		string f;
+		genomes[generator.below(options.genomes)].extract(generator.below(options.length - fragmentLength), fragmentLength, f);
+		fragments.push_back(q % 10 == 9 ? generator.genome(fragmentLength, 0) : generator.mutate(f, options.snpRate));
+	}
+	string latency[2];
+	size_t found[2] = { 0, 0 };
+	vector<DNAMatch> matches;
+	for (int mode = 0; mode != 2; mode++)
+	{
+		cerr << (mode == 0 ? "exact" : "snip") << " searches" << endl;
+		vector<double> micros;
+		for (const string& f : fragments)
+		{
+			matches.clear();
+			start = Clock::now();
+			library.findGenomesWithThisDNA(f, fragmentLength, mode == 0, matches);
+			micros.push_back(1e6 * secondsSince(start));
+			found[mode] += matches.size();
+		}
+		latency[mode] = latencyJSON(micros);
+	}
+
+	cerr << "related genome searches" << endl;
+	double relatedSeconds[2] = { 0, 0 };
+	size_t relatedFound[2] = { 0, 0 };
+	for (int r = 0; r != options.related; r++)
+	{
+		string strain;
+		genomes[r % options.genomes].extract(0, options.length, strain);
+		Genome query("strain" + to_string(r), generator.mutate(strain, options.snpRate));
+		for (int mode = 0; mode != 2; mode++)
+		{
+			vector<GenomeMatch> results;
+			start = Clock::now();
+			library.findRelatedGenomes(query, fragmentLength, mode == 0, 20, results, options.threads);    //above what the repeats alone share
+			relatedSeconds[mode] += secondsSince(start);
+			relatedFound[mode] += results.size();
+		}
+	}
+
+	const double megabytes = fastaText.size() / 1048576.0;
+	const double bases = (double)options.genomes * options.length;
+	cout << fixed << setprecision(4);
+	cout << "{" << endl;
+	cout << "  \"options\": { \"seed\": " << options.seed << ", \"genomes\": " << options.genomes
+		<< ", \"length\": " << options.length << ", \"repeats\": " << options.repeats << ", \"snp_rate\": " << options.snpRate
+		<< ", \"queries\": " << options.queries << ", \"related\": " << options.related << ", \"min_length\": " << options.minLength
+		<< ", \"index\": \"" << indexNames[options.index] << "\", \"threads\": " << options.threads << " }," << endl;
+	cout << "  \"hardware_threads\": " << thread::hardware_concurrency() << "," << endl;
+	cout << "  \"load\": { \"seconds\": " << loadSeconds << ", \"mb_per_second\": " << megabytes / loadSeconds << " }," << endl;
+	cout << "  \"add\": { \"seconds\": " << addSeconds << ", \"megabases_per_second\": " << bases / 1e6 / addSeconds << " }," << endl;
+	cout << "  \"memory\": { \"sequences\": " << memory.sequences << ", \"names\": " << memory.names
+		<< ", \"index_nodes\": " << memory.indexNodes << ", \"postings\": " << memory.postings << ", \"sketches\": " << memory.sketches
+		<< ", \"allocator_overhead\": " << memory.allocatorOverhead << ", \"total\": " << memory.total << " }," << endl;
+	cout << "  \"find_exact\": { \"fragment_length\": " << fragmentLength << ", \"matches\": " << found[0]
+		<< ", \"latency\": " << latency[0] << " }," << endl;
+	cout << "  \"find_snip\": { \"fragment_length\": " << fragmentLength << ", \"matches\": " << found[1]
+		<< ", \"latency\": " << latency[1] << " }," << endl;
+	cout << "  \"related_exact\": { \"queries\": " << options.related << ", \"seconds\": " << relatedSeconds[0]
+		<< ", \"genomes_found\": " << relatedFound[0] << " }," << endl;
+	cout << "  \"related_snip\": { \"queries\": " << options.related << ", \"seconds\": " << relatedSeconds[1]
+		<< ", \"genomes_found\": " << relatedFound[1] << " }" << endl;
+	cout << "}" << endl;
+	return 0;
+}
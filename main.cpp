@@ -9,6 +9,10 @@
 #include <fstream>
 #include <cctype>
 #include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 using namespace std;
 
 // Change the string literal in this declaration to be the path to the
@@ -17,6 +21,10 @@ using namespace std;
 
 const string PROVIDED_DIR = "C:/Users/Tanya/Documents/cs32/Gee-nomics/data";
 
+// Fragments whose hits the library caches.  The strains searched for are
+// often near-identical, so their fragments repeat.
+const size_t QUERY_CACHE_SIZE = 1 << 16;
+
 const string providedFiles[] = {
 	"Ferroplasma_acidarmanus.txt",
 	"Halobacterium_jilantaiense.txt",
@@ -28,6 +36,8 @@ const string providedFiles[] = {
 	"Desulfurococcus_mucosus.txt"
 };
 
+vector<QueryStats> searchStats;      // what each search so far did, for the stats command
+
 void createNewLibrary(GenomeMatcher*& library)
 {
 	cout << "Enter minimum search length (3-100): ";
@@ -41,6 +51,7 @@ void createNewLibrary(GenomeMatcher*& library)
 	}
 	delete library;
 	library = new GenomeMatcher(len);
+	library->setQueryCacheSize(QUERY_CACHE_SIZE);
 }
 
 void addOneGenomeManually(GenomeMatcher* library)
@@ -68,20 +79,40 @@ void addOneGenomeManually(GenomeMatcher* library)
 	}
 	for (char ch : sequence)
 		ch = toupper(ch);
-	library->addGenome(Genome(name, sequence));
+	if (!library->addGenome(Genome(name, sequence)))
+		cout << "The library's index can't hold another genome that long." << endl;
 }
 
-bool loadFile(string filename, vector<Genome>& genomes)
+void removeOneGenome(GenomeMatcher* library)
 {
-	ifstream inputf(filename);
-	if (!inputf)
+	cout << "Enter name: ";
+	string name;
+	getline(cin, name);
+	if (!library->removeGenome(name))
 	{
-		cout << "Cannot open file: " << filename << endl;
-		return false;
+		cout << "No genome named " << name << " in the library." << endl;
+		return;
 	}
+	cout << "Removed " << name << "." << endl;
+}
+
+// Parses a genome data file, returning the message to report if it can't.
+string parseFile(const string& filename, vector<Genome>& genomes)
+{
+	ifstream inputf(filename);
+	if (!inputf)
+		return "Cannot open file: " + filename;
 	if (!Genome::load(inputf, genomes))
+		return "Improperly formatted file: " + filename;
+	return "";
+}
+
+bool loadFile(string filename, vector<Genome>& genomes)
+{
+	string error = parseFile(filename, genomes);
+	if (!error.empty())
 	{
-		cout << "Improperly formatted file: " << filename << endl;
+		cout << error << endl;
 		return false;
 	}
 	return true;
@@ -100,23 +131,138 @@ void loadOneDataFile(GenomeMatcher* library)
 	vector<Genome> genomes;
 	if (!loadFile(filename, genomes))
 		return;
-	for (const auto& g : genomes)
-		library->addGenome(g);
+	if (!library->addGenomes(genomes))
+	{
+		cout << "The library's index can't hold the genomes in " << filename << "." << endl;
+		return;
+	}
 	cout << "Successfully loaded " << genomes.size() << " genomes." << endl;
 }
 
+// A provided file parsed by a loader thread, waiting to be indexed.
+struct ParsedFile
+{
+	bool ready = false;
+	string error;
+	vector<Genome> genomes;
+};
+
+// Parser threads read the provided files ahead while this thread adds them
+// to the library (which indexes each batch on several threads of its own).
+// Files are added and reported in list order, and at most one file per
+// parser waits parsed but not yet added.
 void loadProvidedFiles(GenomeMatcher* library)
 {
-	for (const string& f : providedFiles)
+	const int fileCount = sizeof(providedFiles) / sizeof(providedFiles[0]);
+	const int parsers = max(1, min(fileCount, (int)thread::hardware_concurrency()));
+	vector<ParsedFile> parsed(fileCount);
+	mutex m;
+	condition_variable changed;
+	int nextFile = 0;         //next file for a parser to take
+	int addedFiles = 0;       //files taken off by this thread
+
+	vector<thread> threads;
+	for (int t = 0; t != parsers; t++)
+	{
+		threads.push_back(thread([&]() {
+			unique_lock<mutex> lock(m);
+			for (;;)
+			{
+				changed.wait(lock, [&]() { return nextFile == fileCount || nextFile < addedFiles + parsers; });
+				if (nextFile == fileCount)
+					return;
+				int f = nextFile++;
+				lock.unlock();
+				ParsedFile file;
+				file.error = parseFile(PROVIDED_DIR + "/" + providedFiles[f], file.genomes);
+				file.ready = true;
+				lock.lock();
+				parsed[f] = move(file);
+				changed.notify_all();
+			}
+		}));
+	}
+	for (int f = 0; f != fileCount; f++)
 	{
-		vector<Genome> genomes;
-		if (loadFile(PROVIDED_DIR + "/" + f, genomes))
+		ParsedFile file;
 		{
-			for (const auto& g : genomes)
-				library->addGenome(g);
-			cout << "Loaded " << genomes.size() << " genomes from " << f << endl;
+			unique_lock<mutex> lock(m);
+			changed.wait(lock, [&]() { return parsed[f].ready; });
+			file = move(parsed[f]);
+			addedFiles = f + 1;
+			changed.notify_all();
+		}
+		if (!file.error.empty())
+		{
+			cout << file.error << endl;
+			continue;
 		}
+		if (!library->addGenomes(file.genomes))
+		{
+			cout << "The library's index can't hold the genomes in " << providedFiles[f] << endl;
+			continue;
+		}
+		cout << "Loaded " << file.genomes.size() << " genomes from " << providedFiles[f] << endl;
+	}
+	for (thread& t : threads)
+		t.join();
+}
+
+// Each genome in the file replaces the library's genome of the same name,
+// or is added if there isn't one.
+void updateFromDataFile(GenomeMatcher* library)
+{
+	string filename;
+	cout << "Enter file name: ";
+	getline(cin, filename);
+	if (filename.empty())
+	{
+		cout << "No file name entered." << endl;
+		return;
 	}
+	vector<Genome> genomes;
+	if (!loadFile(filename, genomes))
+		return;
+	int replaced = 0;
+	for (const Genome& g : genomes)
+		replaced += library->replaceGenome(g);
+	cout << "Replaced " << replaced << " genomes and added " << genomes.size() - replaced << "." << endl;
+}
+
+void openIndexFile(GenomeMatcher* library)
+{
+	string filename;
+	cout << "Enter index file name: ";
+	getline(cin, filename);
+	if (filename.empty())
+	{
+		cout << "No file name entered." << endl;
+		return;
+	}
+	if (!library->open(filename))
+	{
+		cout << "Cannot open index file: " << filename << endl;
+		return;
+	}
+	cout << "Opened library with minSearchLength " << library->minimumSearchLength() << endl;
+}
+
+void writeIndexFile(GenomeMatcher* library)
+{
+	string filename;
+	cout << "Enter index file name: ";
+	getline(cin, filename);
+	if (filename.empty())
+	{
+		cout << "No file name entered." << endl;
+		return;
+	}
+	if (!library->save(filename))
+	{
+		cout << "Cannot write index file: " << filename << endl;
+		return;
+	}
+	cout << "Wrote " << filename << endl;
 }
 
 void findGenome(GenomeMatcher* library, bool exactMatch)
@@ -143,7 +289,10 @@ void findGenome(GenomeMatcher* library, bool exactMatch)
 		return;
 	}
 	vector<DNAMatch> matches;
-	if (!library->findGenomesWithThisDNA(sequence, minMatchLength, exactMatch, matches))
+	QueryStats stats;
+	bool found = library->findGenomesWithThisDNA(sequence, minMatchLength, exactMatch, matches, &stats);
+	searchStats.push_back(stats);
+	if (!found)
 	{
 		cout << "No ";
 		if (exactMatch)
@@ -202,7 +351,9 @@ void findRelatedGenomesManual(GenomeMatcher* library)
 		return;
 
 	vector<GenomeMatch> matches;
-	library->findRelatedGenomes(Genome("x", sequence), 2 * minLength, exactMatchOnly, pctThreshold, matches);
+	QueryStats stats;
+	library->findRelatedGenomes(Genome("x", sequence), 2 * minLength, exactMatchOnly, pctThreshold, matches, 0, false, &stats);
+	searchStats.push_back(stats);
 	if (matches.empty())
 	{
 		cout << "    No related genomes were found" << endl;
@@ -237,7 +388,9 @@ void findRelatedGenomesFromFile(GenomeMatcher* library)
 	for (const auto& g : genomes)
 	{
 		vector<GenomeMatch> matches;
-		library->findRelatedGenomes(g, 2 * minLength, exactMatchOnly, pctThreshold, matches);
+		QueryStats stats;
+		library->findRelatedGenomes(g, 2 * minLength, exactMatchOnly, pctThreshold, matches, 0, false, &stats);
+		searchStats.push_back(stats);
 		cout << "  For " << g.name() << endl;
 		if (matches.empty())
 		{
@@ -252,6 +405,72 @@ void findRelatedGenomesFromFile(GenomeMatcher* library)
 	}
 }
 
+// Prints how many of the values fall in each power-of-two range.
+void printHistogram(const string& title, const vector<size_t>& values)
+{
+	vector<int> counts;                  //counts[b] is for values of b bits
+	for (size_t v : values)
+	{
+		size_t bits = 0;
+		while (bits < 64 && (v >> bits) != 0)
+			bits++;
+		if (counts.size() <= bits)
+			counts.resize(bits + 1, 0);
+		counts[bits]++;
+	}
+	int most = *max_element(counts.begin(), counts.end());
+	cout << "  " << title << ":" << endl;
+	for (size_t b = 0; b != counts.size(); b++)
+	{
+		string range = b <= 1 ? to_string(b) : to_string(1ULL << (b - 1)) + "-" + to_string((1ULL << b) - 1);
+		cout << setw(16) << range << setw(8) << counts[b] << "  " << string((40 * counts[b] + most - 1) / most, '*') << endl;
+	}
+}
+
+void showStats()
+{
+	if (searchStats.empty())
+	{
+		cout << "No searches yet." << endl;
+		return;
+	}
+	vector<size_t> nodes, postings, bases, allocations, micros;
+	QueryStats total;
+	for (const QueryStats& s : searchStats)
+	{
+		nodes.push_back(s.trieNodes);
+		postings.push_back(s.postings);
+		bases.push_back(s.basesCompared);
+		allocations.push_back(s.allocations);
+		double seconds = s.lookupSeconds + s.candidateSeconds + s.extendSeconds + s.groupSeconds;
+		micros.push_back((size_t)(seconds * 1e6));
+		total.queries += s.queries;
+		total.cacheHits += s.cacheHits;
+		total.lookupSeconds += s.lookupSeconds;
+		total.candidateSeconds += s.candidateSeconds;
+		total.extendSeconds += s.extendSeconds;
+		total.groupSeconds += s.groupSeconds;
+	}
+	cout << searchStats.size() << " searches of " << total.queries << " fragments, " << total.cacheHits
+		<< " of them answered by the cache" << endl;
+	printHistogram("trie nodes visited per search", nodes);
+	printHistogram("candidate postings per search", postings);
+	printHistogram("bases compared per search", bases);
+	printHistogram("allocations per search", allocations);
+	printHistogram("microseconds per search", micros);
+	double seconds = total.lookupSeconds + total.candidateSeconds + total.extendSeconds + total.groupSeconds;
+	const char* names[] = { "lookup", "candidates", "extension", "grouping" };
+	const double times[] = { total.lookupSeconds, total.candidateSeconds, total.extendSeconds, total.groupSeconds };
+	cout << "  time by phase:" << endl;
+	cout.setf(ios::fixed);
+	cout.precision(2);
+	for (int i = 0; i != 4; i++)
+	{
+		cout << setw(16) << names[i] << setw(10) << 1e3 * times[i] << " ms" << setw(8)
+			<< (seconds > 0 ? 100 * times[i] / seconds : 0) << "%" << endl;
+	}
+}
+
 void showMenu()
 {
 	cout << "        Commands:" << endl;
@@ -259,7 +478,11 @@ void showMenu()
 	cout << "         a - add one genome manually        r - find related genomes (manual)" << endl;
 	cout << "         l - load one data file             f - find related genomes (file)" << endl;
 	cout << "         d - load all provided data files   ? - show this menu" << endl;
+	cout << "         o - open index file                w - write index file" << endl;
 	cout << "         e - find matches exactly           q - quit" << endl;
+	cout << "         x - remove a genome                u - update genomes from a data file" << endl;
+	cout << "         k - compact the library" << endl;
+	cout << "         stats - show statistics of the searches so far" << endl;
 }
 
 int main()
@@ -271,6 +494,7 @@ int main()
 	showMenu();
 
 	GenomeMatcher* library = new GenomeMatcher(defaultMinSearchLength);
+	library->setQueryCacheSize(QUERY_CACHE_SIZE);
 
 	for (;;)
 	{
@@ -280,6 +504,11 @@ int main()
 			break;
 		if (command.empty())
 			continue;
+		if (command == "stats")
+		{
+			showStats();
+			continue;
+		}
 		switch (tolower(command[0]))
 		{
 		default:
@@ -297,12 +526,27 @@ int main()
 		case 'a':
 			addOneGenomeManually(library);
 			break;
+		case 'x':
+			removeOneGenome(library);
+			break;
+		case 'u':
+			updateFromDataFile(library);
+			break;
+		case 'k':
+			library->compact();
+			break;
 		case 'l':
 			loadOneDataFile(library);
 			break;
 		case 'd':
 			loadProvidedFiles(library);
 			break;
+		case 'o':
+			openIndexFile(library);
+			break;
+		case 'w':
+			writeIndexFile(library);
+			break;
 		case 'e':
 			findGenome(library, true);
 			break;
@@ -6,18 +6,27 @@
 #include <istream>
 
 class GenomeImpl;
+class PackedSequence;
 
 class Genome
 {
 public:
     Genome(const std::string& nm, const std::string& sequence);
+    Genome(const std::string& nm, const PackedSequence& sequence);
+    Genome(const std::string& nm, PackedSequence&& sequence);
     ~Genome();
+      // Copies share the name and sequence, which never change, so copying
+      // a genome costs the same however long it is.  A moved-from genome
+      // may only be assigned to or destroyed.
     Genome(const Genome& other);
+    Genome(Genome&& other) noexcept;
     Genome& operator=(const Genome& rhs);
+    Genome& operator=(Genome&& rhs) noexcept;
     static bool load(std::istream& genomeSource, std::vector<Genome>& genomes);
     int length() const;
     std::string name() const;
     bool extract(int position, int length, std::string& fragment) const;
+    const PackedSequence& sequence() const;
 
 private:
     GenomeImpl* m_impl;
@@ -36,17 +45,161 @@ struct GenomeMatch
     double percentMatch;
 };
 
+struct QueryCacheStats
+{
+    size_t hits;          // searches answered from the cache
+    size_t misses;        // searches that had to use the index
+    size_t entries;       // fragments cached now
+    size_t capacity;
+};
+
+  // What a search did and where its time went, for finding out why a query
+  // is slow.  Phases that a search skips stay at 0.  allocations counts the
+  // blocks searching the fragments allocated, in buffers that grew and in
+  // query cache entries, but not the matches returned or the per-thread
+  // tallies findRelatedGenomes sets up once per call.
+struct QueryStats
+{
+    size_t queries = 0;             // fragments searched
+    size_t cacheHits = 0;           // fragments answered by the query cache
+    size_t trieNodes = 0;           // nodes visited in a TRIE_INDEX
+    size_t postings = 0;            // candidate positions found in the index
+    size_t basesCompared = 0;       // while extending the candidates
+    size_t allocations = 0;         // heap blocks, as above
+    double lookupSeconds = 0;       // finding candidates in the index or the cache
+    double candidateSeconds = 0;    // joining, filtering and sorting them by genome
+    double extendSeconds = 0;       // extending each candidate as far as it matches
+    double groupSeconds = 0;        // keeping each genome's best match, or counting them
+};
+
+  // Bytes a library holds, by what they hold.  Each part counts the arrays
+  // it has allocated, including room they have reserved but not filled yet.
+struct MemoryUsage
+{
+    size_t sequences = 0;           // packed bases and N runs
+    size_t names = 0;               // the genome table: names and per-genome records
+    size_t indexNodes = 0;          // trie nodes, k-mer codes and their hash table, or the FM-index's BWT
+    size_t postings = 0;            // the genome positions the index holds
+    size_t sketches = 0;            // prefilter sketches and their inverted index
+    size_t queryCache = 0;
+    size_t allocatorOverhead = 0;   // estimated block headers and rounding for all of the above
+    size_t total = 0;               // all of the above
+    size_t mapped = 0;              // parts viewed in an opened index file rather than allocated
+};
+
 class GenomeMatcherImpl;
 
 class GenomeMatcher
 {
 public:
-    GenomeMatcher(int minSearchLength);
+      // How the library indexes its genomes: a trie of every
+      // minSearchLength-base prefix, an FM-index (compressed suffix array)
+      // that finds exact matches of any length by backward search, or a
+      // hash table of the prefixes packed into 64-bit codes, which looks one
+      // up in a single probe.  HASH_INDEX needs a minSearchLength of at most
+      // 32; a longer one gets a TRIE_INDEX.  MINIMIZER_INDEX is a hash table
+      // of only the minimizers of each minSearchLength-base window, which
+      // finds the same matches in several times less memory for a
+      // minSearchLength of 20 or more, at some cost in search time.
+    enum IndexType { TRIE_INDEX, FM_INDEX, HASH_INDEX, MINIMIZER_INDEX };
+
+    GenomeMatcher(int minSearchLength, IndexType indexType = TRIE_INDEX);
     ~GenomeMatcher();
-    void addGenome(const Genome& genome);
+      // Any number of threads may search while another adds genomes or
+      // opens a library.  A search uses the library as it was when the
+      // search started and never waits for a change; the change is seen by
+      // the searches that start after it's complete.  Changes themselves
+      // run one at a time.  Each addition indexes its genomes on their own,
+      // along with the newest genomes if there are fewer of those, and
+      // indexes of about the same size are merged eight at a time, so a
+      // library built up piece by piece has a few indexes for a search to
+      // visit rather than one.  Returns false,
+      // leaving the library as it was, if the index can't hold the library
+      // with the genome added: an FM_INDEX holds fewer than 2^31 bases,
+      // counting one more for each genome, a TRIE_INDEX about 2^30 bases
+      // for a minSearchLength up to about 16, going down to 2 * 10^8 at 32,
+      // and a HASH_INDEX or MINIMIZER_INDEX fewer than 2^32 k-mers.
+    bool addGenome(const Genome& genome);
+    bool addGenome(Genome&& genome);
+      // Adds a batch of genomes, indexing them on the given number of
+      // threads (0 means one per hardware thread).  The library ends up the
+      // same as after calling addGenome on each genome in order, or as it
+      // was if the index can't hold all of them.
+    bool addGenomes(const std::vector<Genome>& genomes, int threads = 0);
+      // Removes every genome with the given name, returning whether there
+      // was one.  Searches skip a removed genome from then on, but its
+      // postings stay in the index until more than a quarter of the bases
+      // in its part of the index are removed ones, when that part is
+      // rebuilt without them, or until compact() rebuilds every part that
+      // has any.
+    bool removeGenome(const std::string& name);
+      // Removes the genomes with genome's name and adds genome in one
+      // change, so no search sees the library with neither; returns whether
+      // there was one to replace.  The replacement is the newest genome, so
+      // its matches come last.  If the index can't hold genome, the library
+      // is left as it was and the result is false.
+    bool replaceGenome(const Genome& genome);
+    void compact();
+      // Writes the library to an index file that open() can map back in.
+      // Removed genomes are saved as removed; compacting first leaves them
+      // out of the index in the file.  The file is written under another
+      // name and renamed over indexPath when complete, so saving to the
+      // file the library was opened from is safe.
+    bool save(const std::string& indexPath) const;
+      // Replaces the library, including its minimum search length and index
+      // type, with one saved by save().  The file is memory-mapped and
+      // searched in place, so nothing is copied or rebuilt, and opening
+      // reads only the header and directory, checking them against their
+      // checksum and every array against the file's size.  Fails, leaving
+      // the library as it was, if the file is missing, from another
+      // version, or damaged there.  Bytes changed inside the saved arrays
+      // are only caught with verifyChecksum, which reads the whole file to
+      // check their checksum too; searching a file damaged that way may
+      // read outside it.
+    bool open(const std::string& indexPath, bool verifyChecksum = false);
     int minimumSearchLength() const;
-    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches) const;
-    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+      // Given stats, sets *stats to what the search did; without, the
+      // search doesn't spend any time measuring itself.
+    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches,
+        QueryStats* stats = nullptr) const;
+      // Searches for many fragments at once, sharing the index lookups
+      // between them.  matches is replaced by every fragment's matches back
+      // to back: fragment i's are matches[offsets[i]] to
+      // matches[offsets[i + 1] - 1], the ones the single-fragment search
+      // finds, in the same order.  Returns whether any fragment matched.
+    bool findGenomesWithThisDNA(const std::vector<std::string>& fragments, int minimumLength, bool exactMatchOnly,
+        std::vector<DNAMatch>& matches, std::vector<int>& offsets) const;
+      // Searches for the query's fragments on the given number of threads
+      // (0 means one per hardware thread); the results don't depend on it.
+      // With prefilter, genomes whose MinHash sketch shares too little with
+      // the query's to reach matchPercentThreshold are left out of the
+      // search.  That is much faster when few genomes are related to the
+      // query, but the sketches only estimate what is shared, so it may
+      // rarely miss a genome close to the threshold.  stats is as for
+      // findGenomesWithThisDNA, summed over the query's fragments and, for
+      // the times, over the threads.
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results, int threads = 0, bool prefilter = false,
+        QueryStats* stats = nullptr) const;
+      // The single-fragment findGenomesWithThisDNA and findRelatedGenomes
+      // cache what each fragment matched, by fragment, minimum length and
+      // match mode, so searching for a fragment again (as the queries of
+      // near-identical strains do) skips the index.  The cache holds up to
+      // the given number of fragments, 0 turning it off, and is emptied
+      // whenever the library changes.  It starts off: storing a new
+      // fragment's hits takes a few allocations, which only pay off when
+      // searches repeat fragments.  The hit and miss counts are totals since
+      // the library was made.
+    void setQueryCacheSize(size_t fragments);
+    QueryCacheStats queryCacheStats() const;
+      // The memory the library uses now, and an estimate of what it would
+      // use with moreBases more bases in genomes like the ones it has, at the
+      // same minSearchLength.  The estimate grows every part but the query
+      // cache in proportion to the bases; trie nodes grow more slowly than
+      // that as prefixes get shared, so it errs high for a TRIE_INDEX.
+      // Adding genomes eventually merges a mapped index into memory, so the
+      // estimate counts it as allocated.  Each thread's search buffers aren't counted.
+    MemoryUsage memoryUsage() const;
+    MemoryUsage projectedMemoryUsage(size_t moreBases) const;
       // We prevent a GenomeMatcher object from being copied or assigned.
     GenomeMatcher(const GenomeMatcher&) = delete;
     GenomeMatcher& operator=(const GenomeMatcher&) = delete;
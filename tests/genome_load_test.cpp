@@ -0,0 +1,257 @@
+// Checks Genome::load against the parser it replaced, which read a
+// character at a time, on random data files, well formed and not.
+//
+// Build from this directory with, e.g.,
+//   g++ -std=c++17 -O2 -pthread -I.. -o genome_load_test genome_load_test.cpp ../Genome.cpp ../GenomeMatcher.cpp
+// or with CMake from the directory above, which runs it under ctest.  It
+// prints each failure and exits with 1 if there were any.
+
+#include "provided.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cctype>
+using namespace std;
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+	if (!ok)
+	{
+		cout << "FAILED: " << what << endl;
+		failures++;
+	}
+}
+
+const size_t BLOCK_SIZE = 1 << 20;        // what Genome::load reads at a time
+
+// The genomes a parse produced and whether it succeeded, with the error it
+// reported, as one string to compare.
+struct Parse
+{
+	bool ok;
+	vector<pair<string, string> > genomes;
+	string error;
+};
+
+string describe(const Parse& p)
+{
+	string all = p.ok ? "ok" : "failed";
+	all += " [" + p.error + "] " + to_string(p.genomes.size()) + " genomes";
+	for (const pair<string, string>& g : p.genomes)
+		all += "; " + g.first + " (" + to_string(g.second.size()) + " bases)";
+	return all;
+}
+
+bool operator==(const Parse& lhs, const Parse& rhs)
+{
+	return lhs.ok == rhs.ok && lhs.error == rhs.error && lhs.genomes == rhs.genomes;
+}
+
+// The original parser, less its leak.
+bool referenceLoad(istream& genomeSource, vector<pair<string, string> >& genomes, string& error)
+{
+	char c; string s; string dna; bool justNewlined = false;
+	if (!genomeSource.get(c) || c != '>')
+	{
+		error = "Error: file does not start with a name line";
+		return false;
+	}
+	getline(genomeSource, s);
+	while (genomeSource.get(c))
+	{
+		switch (c)
+		{
+		case 'A': case 'C': case 'T': case 'G': case 'N':
+		case 'a': case 'c': case 't': case 'g': case 'n':
+			justNewlined = false;
+			dna += toupper(c);
+			break;
+		case '\n':
+			if (justNewlined)
+			{
+				error = "Error: file contains empty line";
+				return false;
+			}
+			justNewlined = true;
+			break;
+		case '>':
+			if (dna == "")
+			{
+				error = "Error: no bases after name line";
+				return false;
+			}
+			if (s == "")
+			{
+				error = "Error: no characters after > in name line";
+				return false;
+			}
+			genomes.push_back(make_pair(s, dna));
+			s = ""; dna = "";
+			getline(genomeSource, s);
+			justNewlined = false;
+			break;
+		default:
+			error = "Error: invalid base character";
+			return false;
+		}
+	}
+	if (dna == "")
+	{
+		error = "Error: no bases after name line";
+		return false;
+	}
+	if (s == "")
+	{
+		error = "Error: no characters after > in name line";
+		return false;
+	}
+	genomes.push_back(make_pair(s, dna));
+	return true;
+}
+
+Parse parseWithReference(const string& input)
+{
+	Parse p;
+	istringstream in(input);
+	p.ok = referenceLoad(in, p.genomes, p.error);
+	return p;
+}
+
+// A stream buffer that can't seek, so Genome::load can't tell the input's
+// size to reserve for the bases.
+class UnseekableBuffer : public stringbuf
+{
+public:
+	explicit UnseekableBuffer(const string& s) : stringbuf(s, ios::in) {}
+protected:
+	pos_type seekoff(off_type, ios::seekdir, ios::openmode) override { return pos_type(off_type(-1)); }
+	pos_type seekpos(pos_type, ios::openmode) override { return pos_type(off_type(-1)); }
+};
+
+Parse parseWithLoad(const string& input, bool seekable)
+{
+	Parse p;
+	stringstream errors;
+	streambuf* oldErrors = cerr.rdbuf(errors.rdbuf());
+	vector<Genome> genomes;
+	if (seekable)
+	{
+		istringstream in(input);
+		p.ok = Genome::load(in, genomes);
+	}
+	else
+	{
+		UnseekableBuffer buffer(input);
+		istream in(&buffer);
+		p.ok = Genome::load(in, genomes);
+	}
+	cerr.rdbuf(oldErrors);
+	p.error = errors.str();
+	if (!p.error.empty() && p.error.back() == '\n')
+		p.error.pop_back();
+	for (const Genome& g : genomes)
+	{
+		string bases;
+		g.extract(0, g.length(), bases);
+		p.genomes.push_back(make_pair(g.name(), bases));
+	}
+	return p;
+}
+
+// A data file of records with lines of random lengths.  With flaws, now
+// and then it has one of the mistakes the parser must report, or a '>'
+// partway through a line, which starts the next record there.
+string randomFile(mt19937& rng, size_t size, bool flaws)
+{
+	string file;
+	while (file.size() < size)
+	{
+		file += '>';
+		if (!flaws || rng() % 50 != 0)
+			file += "genome " + to_string(rng() % 100000);
+		file += '\n';
+		int lines = flaws && rng() % 50 == 0 ? 0 : 1 + rng() % 20;
+		for (int l = 0; l != lines; l++)
+		{
+			int length = rng() % 100;
+			if (!flaws && length == 0)
+				length = 1;
+			for (int i = 0; i != length; i++)
+				file += "ACGTNacgtn"[rng() % (rng() % 20 == 0 ? 10 : 4)];
+			if (flaws && rng() % 2000 == 0)
+				file += "ACGXRT\r-"[rng() % 8];
+			if (flaws && rng() % 500 == 0 && l + 1 != lines)
+				file += ">inline " + to_string(l);
+			file += '\n';
+		}
+	}
+	if (rng() % 2 == 0 && file.back() == '\n')
+		file.pop_back();
+	return file;
+}
+
+// Lines long enough for the next part of file to start length bytes in.
+string filler(size_t length)
+{
+	string record = ">filler\n";
+	while (record.size() < length)
+	{
+		size_t line = min<size_t>(80, length - record.size() - 1);
+		if (line == 0)                   //no room for a line's bases and newline: lengthen the name
+		{
+			record.insert(1, "f");
+			continue;
+		}
+		record += string(line, 'G') + '\n';
+	}
+	return record;
+}
+
+void compare(const string& input, const string& what)
+{
+	const Parse expected = parseWithReference(input);
+	for (int seekable = 0; seekable != 2; seekable++)
+	{
+		Parse found = parseWithLoad(input, seekable);
+		check(found == expected, what + (seekable ? "" : ", unseekable") + ": expected " + describe(expected)
+			+ ", got " + describe(found));
+	}
+}
+
+int main()
+{
+	mt19937 rng(23);
+	for (int trial = 0; trial != 400; trial++)
+		compare(randomFile(rng, 1 + rng() % 3000, trial % 2 != 0), "small file " + to_string(trial));
+
+	  //the first block ends in each part of a record: its '>', name, bases
+	  //and newlines, and in each mistake
+	const char* tails[] = { ">name\nACGT\nAC\n", "ACGT\n\nACGT\n", "\nACGT\n", "ACG>next one\nACGT",
+		"AC\n>\nACGT\n", "ACGT\nACXGT\n", ">name only\n>next\nA" };
+	for (int offset = -12; offset <= 12; offset++)
+	{
+		for (int flaws = 0; flaws != 2; flaws++)
+		{
+			string input = filler(BLOCK_SIZE + offset) + randomFile(rng, 2000, flaws != 0);
+			compare(input, "record across the first block's end, offset " + to_string(offset));
+		}
+		for (const char* tail : tails)
+			compare(filler(BLOCK_SIZE + offset) + tail, string("\"") + tail + "\" at the first block's end, offset "
+				+ to_string(offset));
+	}
+	for (int trial = 0; trial != 4; trial++)
+		compare(randomFile(rng, 2 * BLOCK_SIZE + rng() % BLOCK_SIZE, trial % 2 != 0), "file of several blocks");
+
+	  //the edge cases the parser has messages for
+	const char* cases[] = { "", "ACGT\n", ">\nACGT\n", ">name\n", ">name\n\n", ">name\nACGT\n\nACGT\n",
+		">name\nACGT\n\n", ">name\nAC GT\n", ">name\nACGT\n>\nAC\n", ">name\nACGT\n>other\n", ">name\nACGT>next\nA",
+		">a\n>b\nACGT\n", ">name\nacgtn\nNNNN" };
+	for (const char* c : cases)
+		compare(c, string("edge case \"") + c + "\"");
+	cout << (failures == 0 ? "All tests passed." : to_string(failures) + " failures.") << endl;
+	return failures == 0 ? 0 : 1;
+}
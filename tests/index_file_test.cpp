@@ -0,0 +1,209 @@
+// Checks of saving and opening index files.
+//
+// Build from this directory with, e.g.,
+//   g++ -std=c++17 -O2 -pthread -I.. -o index_file_test index_file_test.cpp ../Genome.cpp ../GenomeMatcher.cpp
+// and run "index_file_test [directory for the test files]", or build with
+// CMake from the directory above, which runs it under ctest.  It prints
+// each failure and exits with 1 if there were any.
+
+#include "provided.h"
+#include "IndexFile.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <cstdio>
+using namespace std;
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+	if (!ok)
+	{
+		cout << "FAILED: " << what << endl;
+		failures++;
+	}
+}
+
+const char* typeName(GenomeMatcher::IndexType type)
+{
+	switch (type)
+	{
+	case GenomeMatcher::TRIE_INDEX: return "trie";
+	case GenomeMatcher::FM_INDEX: return "fm";
+	case GenomeMatcher::HASH_INDEX: return "hash";
+	default: return "minimizer";
+	}
+}
+
+string randomBases(mt19937& rng, int length)
+{
+	string bases(length, 'A');
+	for (char& c : bases)
+		c = "ACGT"[rng() % 4];
+	return bases;
+}
+
+// Every match of some fragments of the genomes, exact and not, as one
+// string to compare.
+string searchAll(const GenomeMatcher& library, const vector<Genome>& genomes, int minimumLength)
+{
+	string all;
+	for (const Genome& g : genomes)
+	{
+		for (int position = 0; position + 2 * minimumLength <= g.length(); position += 97)
+		{
+			string fragment;
+			g.extract(position, 2 * minimumLength, fragment);
+			fragment[minimumLength + 3] = fragment[minimumLength + 3] == 'A' ? 'C' : 'A';
+			for (int exact = 0; exact != 2; exact++)
+			{
+				vector<DNAMatch> matches;
+				library.findGenomesWithThisDNA(fragment, minimumLength, exact, matches);
+				for (const DNAMatch& m : matches)
+					all += m.genomeName + " " + to_string(m.length) + " " + to_string(m.position) + ";";
+				all += "|";
+			}
+		}
+	}
+	return all;
+}
+
+// Saving to the file the library was opened from replaces it, while the
+// library, still mapped onto the old file, goes on working.
+void testSaveOverOpenFile(const string& directory, GenomeMatcher::IndexType type)
+{
+	const int minimumLength = 20;
+	const string path = directory + "/save_over_" + typeName(type) + ".idx";
+	const string context = string(typeName(type)) + " index saved over its own file: ";
+	mt19937 rng(7);
+	vector<Genome> genomes;
+	for (int i = 0; i != 6; i++)
+		genomes.push_back(Genome("genome " + to_string(i), randomBases(rng, 3000)));
+	GenomeMatcher built(minimumLength, type);
+	built.addGenomes(genomes, 1);
+	check(built.save(path), context + "first save");
+
+	for (int round = 0; round != 2; round++)
+	{
+		GenomeMatcher opened(minimumLength);
+		check(opened.open(path), context + "open");
+		if (round == 1)
+		{
+			Genome added("added", randomBases(rng, 3000));
+			genomes.push_back(added);
+			built.addGenome(added);
+			opened.addGenome(added);
+		}
+		check(opened.save(path), context + "save");
+		string expected = searchAll(built, genomes, minimumLength);
+		check(searchAll(opened, genomes, minimumLength) == expected, context + "search after saving");
+		GenomeMatcher reopened(minimumLength);
+		check(reopened.open(path), context + "reopen");
+		check(searchAll(reopened, genomes, minimumLength) == expected, context + "search after reopening");
+	}
+	remove(path.c_str());
+}
+
+// Two writers saving to one path at once, as two processes might, each
+// write a file of their own, so whichever is renamed there last is whole.
+void testConcurrentSaves(const string& directory)
+{
+	const string path = directory + "/concurrent.idx";
+	const string context = "two writers saving to one path: ";
+	const vector<uint32_t> first(100000, 1);
+	const vector<uint32_t> second(1000, 2);
+	IndexWriter a;
+	IndexWriter b;
+	check(a.open(path) && b.open(path), context + "open");
+	a.value(1);
+	b.value(2);
+	a.array(first.data(), first.size());
+	b.array(second.data(), second.size());
+	check(b.finish(), context + "second writer's finish");
+	check(a.finish(), context + "first writer's finish");
+
+	MappedFile file;
+	check(file.open(path), context + "map");
+	IndexReader in(file);
+	int writer = 0;
+	Storage<uint32_t> saved;
+	check(in.start(true) && in.value(writer) && in.array(saved) && in.atEnd(), context + "read with its checksum");
+	check(writer == 1 && vector<uint32_t>(saved.begin(), saved.end()) == first, context + "not the last file renamed");
+	file.close();
+	remove(path.c_str());
+}
+
+// Writes contents to path, replacing what was there.
+void writeFile(const string& path, const string& contents)
+{
+	ofstream out(path.c_str(), ios::binary | ios::trunc);
+	out.write(contents.data(), contents.size());
+}
+
+// A file with bytes changed at random must not open with its checksums
+// verified, unless every change fell in the padding between arrays, when it
+// must search as it did.  Opening without verifying must still catch
+// changes to the header and directory, which it checks.
+void testDamagedFile(const string& directory, GenomeMatcher::IndexType type)
+{
+	const int minimumLength = 20;
+	const string path = directory + "/damaged_" + typeName(type) + ".idx";
+	const string context = string(typeName(type)) + " index with damaged bytes: ";
+	mt19937 rng(11);
+	vector<Genome> genomes;
+	for (int i = 0; i != 4; i++)
+		genomes.push_back(Genome("genome " + to_string(i), randomBases(rng, 2000)));
+	GenomeMatcher built(minimumLength, type);
+	built.addGenomes(genomes, 1);
+	const string expected = searchAll(built, genomes, minimumLength);
+	check(built.save(path), context + "save");
+	ifstream in(path.c_str(), ios::binary);
+	const string saved((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	in.close();
+
+	for (int trial = 0; trial != 50; trial++)
+	{
+		string damaged = saved;
+		int changes = trial < 25 ? 1 : 200;
+		for (int i = 0; i != changes; i++)
+			damaged[rng() % damaged.size()] ^= (char)(1 + rng() % 255);
+		writeFile(path, damaged);
+		GenomeMatcher opened(minimumLength);
+		if (opened.open(path, true))
+			check(searchAll(opened, genomes, minimumLength) == expected, context + "opened and searched differently");
+	}
+
+	IndexHeader header;
+	memcpy(&header, saved.data(), sizeof(header));
+	const size_t directoryStart = header.directoryOffset;
+	for (int trial = 0; trial != 50; trial++)
+	{
+		string damaged = saved;
+		size_t at = rng() % (sizeof(header) + saved.size() - directoryStart);
+		if (at >= sizeof(header))
+			at += directoryStart - sizeof(header);
+		damaged[at] ^= (char)(1 + rng() % 255);
+		writeFile(path, damaged);
+		GenomeMatcher opened(minimumLength);
+		check(!opened.open(path), context + "opened with a damaged header or directory");
+	}
+	remove(path.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+	string directory = argc > 1 ? argv[1] : ".";
+	const GenomeMatcher::IndexType types[] = { GenomeMatcher::TRIE_INDEX, GenomeMatcher::FM_INDEX,
+		GenomeMatcher::HASH_INDEX, GenomeMatcher::MINIMIZER_INDEX };
+	for (GenomeMatcher::IndexType type : types)
+	{
+		testSaveOverOpenFile(directory, type);
+		testDamagedFile(directory, type);
+	}
+	testConcurrentSaves(directory);
+	cout << (failures == 0 ? "All tests passed." : to_string(failures) + " failures.") << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+// Checks of removeGenome, replaceGenome and compact: after each change a
+// library must find what a library built from just the genomes it still
+// holds finds, and its index must drop the removed genomes' postings when
+// it compacts.
+//
+// Build from this directory with, e.g.,
+//   g++ -std=c++17 -O2 -pthread -I.. -o removal_test removal_test.cpp ../Genome.cpp ../GenomeMatcher.cpp
+// and run "removal_test [directory for the test files]", or build with
+// CMake from the directory above, which runs it under ctest.  It prints
+// each failure and exits with 1 if there were any.
+
+#include "provided.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+using namespace std;
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+	if (!ok)
+	{
+		cout << "FAILED: " << what << endl;
+		failures++;
+	}
+}
+
+const char* typeName(GenomeMatcher::IndexType type)
+{
+	switch (type)
+	{
+	case GenomeMatcher::TRIE_INDEX: return "trie";
+	case GenomeMatcher::FM_INDEX: return "fm";
+	case GenomeMatcher::HASH_INDEX: return "hash";
+	default: return "minimizer";
+	}
+}
+
+const int MIN_SEARCH_LENGTH = 12;
+const int GENOME_COUNT = 12;
+const int GENOME_LENGTH = 5000;
+
+string randomBases(mt19937& rng, int length)
+{
+	string bases(length, 'A');
+	for (char& c : bases)
+		c = "ACGT"[rng() % 4];
+	return bases;
+}
+
+// Copies of one sequence with a base in a hundred changed, so a fragment
+// matches most of them, and a findRelatedGenomes query relates to all.
+vector<Genome> relatedGenomes(mt19937& rng, const string& prefix)
+{
+	const string source = randomBases(rng, GENOME_LENGTH);
+	vector<Genome> genomes;
+	for (int g = 0; g != GENOME_COUNT; g++)
+	{
+		string bases = source;
+		for (int i = 0; i != GENOME_LENGTH / 100; i++)
+			bases[rng() % GENOME_LENGTH] = "ACGT"[rng() % 4];
+		genomes.push_back(Genome(prefix + to_string(g), bases));
+	}
+	return genomes;
+}
+
+string describe(const vector<DNAMatch>& matches)
+{
+	string all;
+	for (const DNAMatch& m : matches)
+		all += m.genomeName + " " + to_string(m.length) + " " + to_string(m.position) + ";";
+	return all;
+}
+
+string describe(const vector<GenomeMatch>& matches)
+{
+	string all;
+	for (const GenomeMatch& m : matches)
+		all += m.genomeName + " " + to_string(m.percentMatch) + ";";
+	return all;
+}
+
+// Fragments of the genomes, some with a SNiP, and a query made of pieces of
+// them.
+struct Queries
+{
+	vector<string> fragments;
+	Genome related = Genome("query", "");
+};
+
+Queries makeQueries(mt19937& rng, const vector<Genome>& genomes)
+{
+	Queries queries;
+	for (int q = 0; q != 60; q++)
+	{
+		string f;
+		genomes[rng() % genomes.size()].extract(rng() % (GENOME_LENGTH - 40), 40, f);
+		if (q % 2 != 0)
+			f[20] = f[20] == 'A' ? 'C' : 'A';
+		queries.fragments.push_back(f);
+	}
+	string bases;
+	genomes[0].extract(0, GENOME_LENGTH / 2, bases);
+	queries.related = Genome("query", bases);
+	return queries;
+}
+
+// Whether library finds what a library of just expected, in that order, does.
+void checkSameAs(const GenomeMatcher& library, const vector<Genome>& expected, const Queries& queries,
+	GenomeMatcher::IndexType type, const string& context)
+{
+	GenomeMatcher reference(MIN_SEARCH_LENGTH, type);
+	reference.addGenomes(expected, 1);
+	for (int exact = 0; exact != 2; exact++)
+	{
+		const string mode = exact ? "exact " : "snip ";
+		for (const string& f : queries.fragments)
+		{
+			vector<DNAMatch> found, wanted;
+			library.findGenomesWithThisDNA(f, 30, exact != 0, found);
+			reference.findGenomesWithThisDNA(f, 30, exact != 0, wanted);
+			check(describe(found) == describe(wanted), context + mode + f + ": expected " + describe(wanted)
+				+ ", got " + describe(found));
+		}
+		vector<DNAMatch> found, wanted;
+		vector<int> foundOffsets, wantedOffsets;
+		library.findGenomesWithThisDNA(queries.fragments, 30, exact != 0, found, foundOffsets);
+		reference.findGenomesWithThisDNA(queries.fragments, 30, exact != 0, wanted, wantedOffsets);
+		check(describe(found) == describe(wanted) && foundOffsets == wantedOffsets, context + mode + "batch");
+		vector<GenomeMatch> related, relatedWanted;
+		library.findRelatedGenomes(queries.related, 2 * MIN_SEARCH_LENGTH, exact != 0, 10, related, 1);
+		reference.findRelatedGenomes(queries.related, 2 * MIN_SEARCH_LENGTH, exact != 0, 10, relatedWanted, 1);
+		check(describe(related) == describe(relatedWanted), context + mode + "related genomes: expected "
+			+ describe(relatedWanted) + ", got " + describe(related));
+	}
+}
+
+// The postings the index holds for the fragments, removed genomes' too:
+// searches count them before skipping those.
+size_t postingsFound(const GenomeMatcher& library, const Queries& queries)
+{
+	size_t postings = 0;
+	for (const string& f : queries.fragments)
+	{
+		vector<DNAMatch> matches;
+		QueryStats stats;
+		library.findGenomesWithThisDNA(f, 30, false, matches, &stats);
+		postings += stats.postings;
+	}
+	return postings;
+}
+
+// Removing genomes from a library in one segment: searches skip them at
+// once, the index keeps them until more than a quarter of its bases are
+// removed ones, and compact() drops them whatever their share.
+void testRemoval(GenomeMatcher::IndexType type)
+{
+	const string context = string(typeName(type)) + " index: ";
+	mt19937 rng(41);
+	vector<Genome> genomes = relatedGenomes(rng, "genome ");
+	const Queries queries = makeQueries(rng, genomes);
+	GenomeMatcher library(MIN_SEARCH_LENGTH, type);
+	library.addGenomes(genomes, 1);
+	const size_t allPostings = postingsFound(library, queries);
+
+	check(!library.removeGenome("no such genome"), context + "removed a genome that isn't there");
+	vector<Genome> kept = genomes;
+	for (int removed = 1; removed <= GENOME_COUNT / 4; removed++)
+	{
+		check(library.removeGenome(kept[1].name()), context + "didn't remove " + kept[1].name());
+		check(!library.removeGenome(genomes[removed].name()), context + "removed " + genomes[removed].name() + " twice");
+		kept.erase(kept.begin() + 1);
+		checkSameAs(library, kept, queries, type, context + to_string(removed) + " removed, ");
+	}
+	check(postingsFound(library, queries) == allPostings, context + "compacted with a quarter of the bases removed");
+
+	library.removeGenome(kept[1].name());
+	kept.erase(kept.begin() + 1);
+	const size_t compactedPostings = postingsFound(library, queries);
+	check(compactedPostings < allPostings, context + "didn't compact with more than a quarter of the bases removed");
+	checkSameAs(library, kept, queries, type, context + "compacted, ");
+
+	library.removeGenome(kept[1].name());
+	kept.erase(kept.begin() + 1);
+	check(postingsFound(library, queries) == compactedPostings, context + "compacted again after one removal");
+	library.compact();
+	check(postingsFound(library, queries) < compactedPostings, context + "compact() left a removed genome's postings");
+	checkSameAs(library, kept, queries, type, context + "after compact(), ");
+}
+
+// Replacing a genome: its old sequence is gone from the results, its new one
+// is found under its name, after every other genome, and a replacement with
+// a new name just adds the genome.
+void testReplace(GenomeMatcher::IndexType type)
+{
+	const string context = string(typeName(type)) + " index: ";
+	mt19937 rng(43);
+	vector<Genome> genomes = relatedGenomes(rng, "genome ");
+	const Queries queries = makeQueries(rng, genomes);
+	GenomeMatcher library(MIN_SEARCH_LENGTH, type);
+	for (const Genome& g : genomes)             //several segments
+		library.addGenome(g);
+
+	string oldBases;
+	genomes[3].extract(100, 40, oldBases);
+	const Genome replacement(genomes[3].name(), randomBases(rng, GENOME_LENGTH));
+	check(library.replaceGenome(replacement), context + "didn't replace " + replacement.name());
+	vector<Genome> kept = genomes;
+	kept.erase(kept.begin() + 3);
+	kept.push_back(replacement);
+	checkSameAs(library, kept, queries, type, context + "replaced, ");
+
+	string newBases;
+	replacement.extract(200, 40, newBases);
+	vector<DNAMatch> matches;
+	library.findGenomesWithThisDNA(newBases, 40, true, matches);
+	check(matches.size() == 1 && matches[0].genomeName == replacement.name() && matches[0].position == 200,
+		context + "the replacement's bases found as " + describe(matches));
+	matches.clear();
+	library.findGenomesWithThisDNA(oldBases, 40, true, matches);
+	bool oldFound = false;
+	for (const DNAMatch& m : matches)
+		oldFound = oldFound || (m.genomeName == replacement.name() && m.position == 100);
+	check(!oldFound, context + "the replaced genome's bases still found");
+
+	const Genome added("new genome", randomBases(rng, GENOME_LENGTH));
+	check(!library.replaceGenome(added), context + "replaced a genome that wasn't there");
+	kept.push_back(added);
+	checkSameAs(library, kept, queries, type, context + "replaced a new name, ");
+}
+
+// A library with removed genomes saved and opened again, compacted first
+// and not.
+void testSaveWithRemoved(const string& directory, GenomeMatcher::IndexType type)
+{
+	const string context = string(typeName(type)) + " index: ";
+	const string path = directory + "/removed_" + typeName(type) + ".idx";
+	mt19937 rng(47);
+	vector<Genome> genomes = relatedGenomes(rng, "genome ");
+	const Queries queries = makeQueries(rng, genomes);
+	for (int compacted = 0; compacted != 2; compacted++)
+	{
+		GenomeMatcher library(MIN_SEARCH_LENGTH, type);
+		library.addGenomes(genomes, 1);
+		library.removeGenome(genomes[2].name());
+		library.removeGenome(genomes[7].name());
+		if (compacted)
+			library.compact();
+		vector<Genome> kept = genomes;
+		kept.erase(kept.begin() + 7);
+		kept.erase(kept.begin() + 2);
+		check(library.save(path), context + "couldn't save to " + path);
+		GenomeMatcher opened(MIN_SEARCH_LENGTH);
+		check(opened.open(path), context + "couldn't open " + path);
+		checkSameAs(opened, kept, queries, type, context + (compacted ? "compacted, saved and opened, "
+			: "saved and opened, "));
+		check(!opened.removeGenome(genomes[2].name()), context + "a removed genome came back from the file");
+		check(opened.removeGenome(genomes[3].name()), context + "couldn't remove a genome from the opened file");
+		kept.erase(kept.begin() + 2);
+		checkSameAs(opened, kept, queries, type, context + "removed from the opened file, ");
+	}
+	remove(path.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+	string directory = argc > 1 ? argv[1] : ".";
+	const GenomeMatcher::IndexType types[] = { GenomeMatcher::TRIE_INDEX, GenomeMatcher::FM_INDEX,
+		GenomeMatcher::HASH_INDEX, GenomeMatcher::MINIMIZER_INDEX };
+	for (GenomeMatcher::IndexType type : types)
+	{
+		testRemoval(type);
+		testReplace(type);
+		testSaveWithRemoved(directory, type);
+	}
+	cout << (failures == 0 ? "All tests passed." : to_string(failures) + " failures.") << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+// Checks findGenomesWithThisDNA against a search of every genome position,
+// above all for SNiP searches long enough to be found from the fragment's
+// two exact halves.
+//
+// Build from this directory with, e.g.,
+//   g++ -std=c++17 -O2 -pthread -I.. -o snip_search_test snip_search_test.cpp ../Genome.cpp ../GenomeMatcher.cpp
+// or with CMake from the directory above, which runs it under ctest.  It
+// prints each failure and exits with 1 if there were any.
+
+#include "provided.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+using namespace std;
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+	if (!ok)
+	{
+		cout << "FAILED: " << what << endl;
+		failures++;
+	}
+}
+
+const char* typeName(GenomeMatcher::IndexType type)
+{
+	switch (type)
+	{
+	case GenomeMatcher::TRIE_INDEX: return "trie";
+	case GenomeMatcher::FM_INDEX: return "fm";
+	case GenomeMatcher::HASH_INDEX: return "hash";
+	default: return "minimizer";
+	}
+}
+
+string randomBases(mt19937& rng, int length)
+{
+	string bases(length, 'A');
+	for (char& c : bases)
+		c = "ACGT"[rng() % 4];
+	return bases;
+}
+
+// Changes the base at position to another one.
+void mutate(mt19937& rng, string& bases, int position)
+{
+	bases[position] = "ACGT"[(string("ACGT").find(bases[position]) + 1 + rng() % 3) % 4];
+}
+
+// Genomes made of pieces of a few shared ones, with scattered SNiPs, so a
+// fragment matches several of them, exactly and not.
+vector<Genome> relatedGenomes(mt19937& rng, int count, int length)
+{
+	vector<string> sources;
+	for (int i = 0; i != 3; i++)
+		sources.push_back(randomBases(rng, length));
+	vector<Genome> genomes;
+	for (int g = 0; g != count; g++)
+	{
+		string bases;
+		while ((int)bases.size() < length)
+		{
+			const string& source = sources[rng() % sources.size()];
+			int piece = 50 + rng() % 400;
+			bases += source.substr(rng() % (length - piece), piece);
+		}
+		bases.resize(length);
+		for (int i = 0; i != length / 100; i++)
+			mutate(rng, bases, rng() % length);
+		genomes.push_back(Genome("genome " + to_string(g), bases));
+	}
+	return genomes;
+}
+
+// What findGenomesWithThisDNA must find: for each genome, in the order they
+// were added, the longest match of at least minimumLength bases that starts
+// with the fragment's first base and has no more than one other base
+// different (none if exactMatchOnly), the earliest of the longest on ties.
+vector<DNAMatch> searchEverywhere(const vector<Genome>& genomes, const string& fragment, int minimumLength,
+	bool exactMatchOnly)
+{
+	vector<DNAMatch> matches;
+	for (const Genome& g : genomes)
+	{
+		string bases;
+		g.extract(0, g.length(), bases);
+		DNAMatch best;
+		best.genomeName = g.name();
+		best.length = 0;
+		best.position = 0;
+		for (int position = 0; position != (int)bases.size(); position++)
+		{
+			if (bases[position] != fragment[0])
+				continue;
+			int length = 1;
+			int mismatches = 0;
+			for (; length != (int)fragment.size() && position + length != (int)bases.size(); length++)
+			{
+				if (bases[position + length] != fragment[length] && ++mismatches > (exactMatchOnly ? 0 : 1))
+					break;
+			}
+			if (length > best.length)
+			{
+				best.length = length;
+				best.position = position;
+			}
+		}
+		if (best.length >= minimumLength)
+			matches.push_back(best);
+	}
+	return matches;
+}
+
+string describe(const vector<DNAMatch>& matches)
+{
+	string all;
+	for (const DNAMatch& m : matches)
+		all += m.genomeName + " " + to_string(m.length) + " " + to_string(m.position) + ";";
+	return all;
+}
+
+// Fragments of the genomes with no, one or two SNiPs after the first base,
+// searched for one at a time and in a batch, by a library built in one go
+// and by one built a genome at a time (which searches several segments).
+void testAgainstEveryPosition(GenomeMatcher::IndexType type, int minSearchLength)
+{
+	const string context = string(typeName(type)) + " index, minSearchLength " + to_string(minSearchLength) + ": ";
+	mt19937 rng(17 + minSearchLength);
+	vector<Genome> genomes = relatedGenomes(rng, 8, 3000);
+	GenomeMatcher whole(minSearchLength, type);
+	whole.addGenomes(genomes, 1);
+	GenomeMatcher pieces(minSearchLength, type);
+	for (const Genome& g : genomes)
+		pieces.addGenome(g);
+
+	vector<string> fragments;
+	vector<int> minimumLengths;
+	for (int q = 0; q != 150; q++)
+	{
+		int minimumLength = minSearchLength + rng() % (2 * minSearchLength + 1);
+		string fragment;
+		const Genome& source = genomes[rng() % genomes.size()];
+		int length = minimumLength + rng() % 20;
+		source.extract(rng() % (source.length() - length), length, fragment);
+		for (int snips = q % 3; snips != 0; snips--)
+			mutate(rng, fragment, 1 + rng() % (length - 1));
+		fragments.push_back(fragment);
+		minimumLengths.push_back(minimumLength);
+	}
+
+	for (int exact = 0; exact != 2; exact++)
+	{
+		const string mode = exact ? "exact search " : "snip search ";
+		for (size_t q = 0; q != fragments.size(); q++)
+		{
+			const string expected = describe(searchEverywhere(genomes, fragments[q], minimumLengths[q], exact));
+			vector<DNAMatch> found;
+			whole.findGenomesWithThisDNA(fragments[q], minimumLengths[q], exact, found);
+			check(describe(found) == expected, context + mode + fragments[q]);
+			found.clear();
+			pieces.findGenomesWithThisDNA(fragments[q], minimumLengths[q], exact, found);
+			check(describe(found) == expected, context + mode + "over segments, " + fragments[q]);
+		}
+		  //the batch search takes one minimum length, so use the halves' one
+		const int minimumLength = 2 * minSearchLength;
+		vector<string> batch;
+		for (const string& f : fragments)
+		{
+			if ((int)f.size() >= minimumLength)
+				batch.push_back(f);
+		}
+		vector<DNAMatch> found;
+		vector<int> offsets;
+		whole.findGenomesWithThisDNA(batch, minimumLength, exact, found, offsets);
+		for (size_t q = 0; q != batch.size(); q++)
+		{
+			vector<DNAMatch> one(found.begin() + offsets[q], found.begin() + offsets[q + 1]);
+			check(describe(one) == describe(searchEverywhere(genomes, batch[q], minimumLength, exact)),
+				context + mode + "in a batch, " + batch[q]);
+		}
+	}
+}
+
+int main()
+{
+	const GenomeMatcher::IndexType types[] = { GenomeMatcher::TRIE_INDEX, GenomeMatcher::FM_INDEX,
+		GenomeMatcher::HASH_INDEX, GenomeMatcher::MINIMIZER_INDEX };
+	for (GenomeMatcher::IndexType type : types)
+	{
+		for (int minSearchLength : { 8, 12, 20 })
+			testAgainstEveryPosition(type, minSearchLength);
+	}
+	cout << (failures == 0 ? "All tests passed." : to_string(failures) + " failures.") << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+// Builds an index file for GenomeMatcher::open from genome data files, so
+// the test harness and other programs can skip loading and indexing.
+//
+// Build from this directory with, e.g.,
+//   g++ -std=c++17 -O2 -pthread -I.. -o build_index build_index.cpp ../Genome.cpp ../GenomeMatcher.cpp
+// and run
+//   build_index [-fm | -hash | -minimizer] <minSearchLength> <index file> <genome file>...
+//   build_index -verify <index file>
+// -verify opens the file with its checksums checked, which reads all of it.
+
+#include "provided.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+using namespace std;
+
+int usage()
+{
+	cerr << "usage: build_index [-fm | -hash | -minimizer] <minSearchLength> <index file> <genome file>..." << endl;
+	cerr << "       build_index -verify <index file>" << endl;
+	return 1;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "-verify") == 0)
+	{
+		GenomeMatcher library(1);
+		if (!library.open(argv[2], true))
+		{
+			cerr << argv[2] << " is not a valid index file" << endl;
+			return 1;
+		}
+		cout << argv[2] << ": OK, minSearchLength " << library.minimumSearchLength() << endl;
+		return 0;
+	}
+
+	int arg = 1;
+	GenomeMatcher::IndexType indexType = GenomeMatcher::TRIE_INDEX;
+	if (arg < argc && strcmp(argv[arg], "-fm") == 0)
+	{
+		indexType = GenomeMatcher::FM_INDEX;
+		arg++;
+	}
+	else if (arg < argc && strcmp(argv[arg], "-hash") == 0)
+	{
+		indexType = GenomeMatcher::HASH_INDEX;
+		arg++;
+	}
+	else if (arg < argc && strcmp(argv[arg], "-minimizer") == 0)
+	{
+		indexType = GenomeMatcher::MINIMIZER_INDEX;
+		arg++;
+	}
+	if (argc - arg < 3)
+		return usage();
+	int minSearchLength = atoi(argv[arg++]);
+	if (minSearchLength <= 0)
+		return usage();
+	string indexPath = argv[arg++];
+
+	GenomeMatcher library(minSearchLength, indexType);
+	for (; arg < argc; arg++)
+	{
+		ifstream inputf(argv[arg]);
+		vector<Genome> genomes;
+		if (!inputf || !Genome::load(inputf, genomes))
+		{
+			cerr << "Cannot load genome file: " << argv[arg] << endl;
+			return 1;
+		}
+		if (!library.addGenomes(genomes))
+		{
+			cerr << "The index can't hold the genomes in " << argv[arg] << endl;
+			return 1;
+		}
+		cout << "Indexed " << genomes.size() << " genomes from " << argv[arg] << endl;
+	}
+	if (!library.save(indexPath))
+	{
+		cerr << "Cannot write index file: " << indexPath << endl;
+		return 1;
+	}
+	cout << "Wrote " << indexPath << endl;
+	return 0;
+}